@@ -31,6 +31,9 @@
 
 /* General libraries */
 #include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
 
 /* User defined libraries */
 #include "i2c.h"
@@ -54,225 +57,2126 @@
 #define I2C_STATUS_RX_DATA_ACK  0x50  // Data transmitted and ACK received
 #define I2C_STATUS_RX_DATA_NACK 0x58  // Data transmitted and NACK received 
 
-// I2C Protocol Macros
-#define I2C_TWCR_INIT()			TWCR = (0 << TWINT) | (0 << TWEA) | (0 << TWSTA) | (0 << TWSTO) | (0 << TWWC) | (1 << TWEN) | (1 << TWIE)
+// I2C Status Codes Slave RX Mode
+#define I2C_STATUS_SR_ADDR_ACK  0x60  // Own SLA+W received and ACK returned
+#define I2C_STATUS_SR_ARB_LOST  0x68  // Arbitration lost in SLA+R/W, own SLA+W received and ACK returned
+#define I2C_STATUS_SR_DATA_ACK  0x80  // Data received and ACK returned
+#define I2C_STATUS_SR_DATA_NACK 0x88  // Data received and NACK returned
+#define I2C_STATUS_SR_STOP      0xA0  // STOP or repeated START received while addressed
 
-// Master Transmitter Mode
-#define I2C_TX_START()			TWCR = (1 << TWINT) | (1 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | (1 << TWIE)
-#define I2C_TX_REPEAT_START()	TWCR = (1 << TWINT) | (1 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | (1 << TWIE)
-#define I2C_TX_TRANSMIT()		TWCR = (1 << TWINT) | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | (1 << TWIE)
-#define I2C_TX_STOP()			TWCR = (1 << TWINT) | (0 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | (0 << TWIE)
-#define I2C_TX_STOP_START()		TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | (1 << TWIE)
+// I2C Status Codes Slave TX Mode
+#define I2C_STATUS_ST_ADDR_ACK  0xA8  // Own SLA+R received and ACK returned
+#define I2C_STATUS_ST_ARB_LOST  0xB0  // Arbitration lost in SLA+R/W, own SLA+R received and ACK returned
+#define I2C_STATUS_ST_DATA_ACK  0xB8  // Data transmitted and ACK received
+#define I2C_STATUS_ST_DATA_NACK 0xC0  // Data transmitted and NACK received
+#define I2C_STATUS_ST_LAST_DATA 0xC8  // Last data byte (TWEA off) transmitted and ACK received
+
+// Own address answered between master transfers, the interrupt stays on for it
+#if I2C_SLAVE
+#define I2C_TWEA				bus->twea
+#define I2C_IDLE				(bus->twea ? (1 << TWIE) : 0)
+#else
+#define I2C_TWEA				0
+#define I2C_IDLE				0
+#endif
+
+// TWI controller of the bus in scope, folded to a constant where the bus is known at compile time
+#if I2C_BUSES > 1
+#define I2C_INDEX(bus)			(__builtin_constant_p((bus) - buses) ? (uint8_t)((bus) - buses) : (bus)->index)
+#define I2C_ISR_INLINE			inline __attribute__((always_inline)) // One copy per TWI vector, see I2C_INDEX
+#else
+#define I2C_INDEX(bus)			0
+#define I2C_ISR_INLINE			inline
+#endif
+
+// I2C Protocol Macros, acting on the bus in scope
+#define I2C_TWCR_INIT()			I2C_TWCR(I2C_INDEX(bus)) = (0 << TWINT) | I2C_TWEA | (0 << TWSTA) | (0 << TWSTO) | (0 << TWWC) | (1 << TWEN) | (1 << TWIE)
+
+// TWI interrupt enable, cleared while a polled transfer owns the bus
+#if I2C_POLLED
+#define I2C_TWIE				bus->twie
+#else
+#define I2C_TWIE				(1 << TWIE)
+#endif
+
+// Master Transmitter Mode, a START may have to wait for another master to release the bus
+#define I2C_TX_START()			(bus->waiting = 1, I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (1 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | I2C_TWIE)
+#define I2C_TX_REPEAT_START()	I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (1 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | I2C_TWIE
+#define I2C_TX_TRANSMIT()		I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | I2C_TWIE
+#define I2C_TX_STOP()			I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (0 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | I2C_IDLE
+#define I2C_TX_STOP_START()		(bus->waiting = 1, I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (1 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | I2C_TWIE)
+#define I2C_TX_RELEASE()		I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | I2C_IDLE // Lost arbitration, no STOP
 
 // Master Receiver Mode
-#define I2C_RX_START()			TWCR = (1 << TWINT) | (1 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | (1 << TWIE)
-#define I2C_RX_TRANSMIT()		TWCR = (1 << TWINT) | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | (1 << TWIE)
-#define I2C_RX_STOP()			TWCR = (1 << TWINT) | (0 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | (0 << TWIE)
-#define I2C_RX_STOP_START()		TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | (1 << TWIE)
-#define I2C_RX_SEND_NACK()		TWCR = (1 << TWINT) | (0 << TWSTA) | (0 << TWSTO) | (0 << TWEA) | (1 << TWEN) | (1 << TWIE)
-#define I2C_RX_SEND_ACK()		TWCR = (1 << TWINT) | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE)
+#define I2C_RX_START()			I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (1 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | I2C_TWIE
+#define I2C_RX_TRANSMIT()		I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | I2C_TWIE
+#define I2C_RX_STOP()			I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (0 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | I2C_IDLE
+#define I2C_RX_STOP_START()		I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | I2C_TWEA | (1 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | I2C_TWIE
+#define I2C_RX_SEND_NACK()		I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | (0 << TWSTA) | (0 << TWSTO) | (0 << TWEA) | (1 << TWEN) | I2C_TWIE
+#define I2C_RX_SEND_ACK()		I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEA) | (1 << TWEN) | I2C_TWIE
+
+// Slave Mode
+#define I2C_SLAVE_ACK()			I2C_TWCR(I2C_INDEX(bus)) = (1 << TWINT) | (1 << TWEA) | (0 << TWSTA) | (0 << TWSTO) | (1 << TWEN) | (1 << TWIE)
+
+// Keeps the compiler from moving stores to a transfer past its publication
+#define I2C_BARRIER()			__asm__ __volatile__ ("" ::: "memory")
 
 typedef enum {
     I2C_ACTIVE,
-    I2C_INACTIVE
+    I2C_INACTIVE,
+    I2C_ADDRESSED   // Slave transfer, master payloads wait for the STOP
 } i2c_state_t;
 
-static queue_t q;
-static queue_t* queue = NULL;
-static payload_t* payload = NULL;
-static i2c_state_t I2C_STATE;
+/* Pool entry wrapping a payload. The payload must remain the first member. */
+typedef struct i2c_transfer_t {
+	payload_t payload;              // Device, mode and callback, data of the first segment
+	i2c_callback_t callback;        // Completion callback with context, see i2c_payload_set_callback()
+	void* context;
+	uint8_t* cursor;                // Next byte of the segment on the bus
+	uint16_t remaining;             // Bytes left in the segment or stream chunk
+	uint16_t length;                // Payload data length, payload_t only holds 8 bits
+	i2c_segment_t* segments;        // Segments still to be transferred
+	uint8_t number_of_segments;
+	i2c_segment_t read_segment;     // Read phase of i2c_write_read()
+	volatile i2c_error_t status;    // Result, I2C_ERROR_BUSY while queued or on the bus
+	uint32_t transferred;           // Data bytes ACKed by the slave or received
+	i2c_stream_fn stream;           // Refill/drain hook of the last segment
+	uint32_t stream_length;         // Total bytes of the last segment, chunks included
+	uint32_t stream_left;           // Stream bytes not yet handed out in a chunk
+	uint16_t watermark;             // Received bytes between progress notifications (0 = off)
+	uint16_t watermark_left;
+	i2c_segment_t origin;           // First segment and segment list, to rewind for a retry
+	i2c_segment_t* origin_segments;
+	uint8_t origin_number_of_segments;
+	uint8_t retries;                // Retries left
+	uint8_t arb_losses;             // Lost arbitrations since submission
+	uint8_t retry_flags;
+	uint16_t retry_delay;           // Ticks before the next retry
+	uint16_t retry_ticks;           // Countdown while parked
+	uint8_t flags;
+	uint8_t next;                   // Free list link, retry/ready list link while parked
+#if I2C_STATS
+	uint16_t submitted_at;          // I2C_STATS_TIMESTAMP() at submission
+#endif
+#if I2C_PERIODIC_JOBS
+	uint8_t job;                    // Job table slot of a periodic transfer
+#endif
+#if I2C_FAR_FLASH
+	uint_farptr_t far_data;         // Base of far flash data, the cursor holds the offset
+#endif
+	const uint8_t* table;           // Next register table record (flash)
+	uint8_t record_delay;           // Ticks to wait after the current record
+	uint8_t address;                // Of the device, or of the current table record
+} i2c_transfer_t;
+
+// Transfer flags
+#define I2C_TRANSFER_TRACKED  0x01 // Kept after completion until the handle reports its result
+#define I2C_TRANSFER_PERIODIC 0x02 // Owned by a periodic job, re-armed by i2c_tick()
+#define I2C_TRANSFER_TABLE    0x04 // Walks a register table, see i2c_payload_create_table()
+#define I2C_TRANSFER_FLASH    0x08 // Data is read from flash
+#define I2C_TRANSFER_FAR      0x10 // Flash data beyond 64 KB, see far_data
+#define I2C_TRANSFER_COMPLETING 0x20 // Waits in the completion ring for i2c_process_completions()
+
+// Origin only, marks far flash data
+#define I2C_SEGMENT_FAR       0x80
+
+#if I2C_PERIODIC_JOBS
+/* Periodic register read, the transfer is a write of reg followed by a read into the back buffer. */
+typedef struct i2c_job_t {
+	i2c_transfer_t* transfer;       // NULL while the slot is free
+	uint8_t reg;
+	uint8_t* buffer;                // Two samples of number_of_bytes
+	uint8_t number_of_bytes;
+	volatile uint8_t front;         // Half holding the latest good sample
+	volatile uint8_t sequence;      // Bumped on every good sample
+	volatile i2c_error_t result;    // Result of the last sample
+	uint16_t period;
+	uint16_t countdown;
+	volatile uint16_t overruns;
+} i2c_job_t;
+#endif
+
+#define I2C_POOL_END 0xFF
+
+// Marks device_t.twps as set by i2c_device_set_speed(), the low bits hold the prescaler
+#define I2C_SPEED_SET 0x80
+
+#if I2C_SLAVE
+/* Register map attached by i2c_init(), served in place by the ISR */
+typedef struct i2c_slave_t {
+	uint8_t* regs;                  // NULL while not attached
+	const uint8_t* write_mask;
+	uint16_t size;
+	i2c_slave_fn callback;
+	uint16_t pointer;               // Auto-incrementing register pointer, stops at size
+	uint8_t select;                 // Next received byte sets the pointer
+	uint8_t reg;                    // First register of the current write
+	uint16_t written;               // Bytes stored by the current write
+} i2c_slave_t;
+#endif
+
+/* Driver state of one TWI controller, see I2C_BUSES */
+typedef struct i2c_bus_t {
+	/*
+	 * Submission rings of pool indices, one per priority level. Single producer
+	 * (thread) and single consumer (ISR side), each index is written by one side
+	 * only, so neither side masks interrupts. The indices run freely and wrap at 256.
+	 */
+	volatile uint8_t ring[I2C_PRIORITY_LEVELS][I2C_QUEUE_SIZE];
+	volatile uint8_t ring_head[I2C_PRIORITY_LEVELS];  // Written by the thread
+	volatile uint8_t ring_tail[I2C_PRIORITY_LEVELS];  // Written by the ISR side
+	
+	uint8_t scheduler;
+	uint8_t aging;
+	uint8_t waited[I2C_PRIORITY_LEVELS];  // Strict: picks a level was passed over
+	uint8_t credit[I2C_PRIORITY_LEVELS];  // WRR: picks left in this round
+	
+	payload_t* payload;             // On the bus
+	volatile i2c_state_t state;
+	volatile uint8_t kicking;       // Thread is starting the bus, ISRs keep off
+#if I2C_POLLED
+	uint8_t twie;
+	volatile uint8_t polling;       // Thread drives the state machine, see i2c_write_polled()
+#endif
+	uint8_t chain_limit;            // Max. payloads chained by repeated START before a STOP
+	uint8_t chain_length;
+	uint8_t retry_head;             // Transfers waiting for their retry delay
+	uint8_t ready_head;             // Retries due, served before the ring
+	uint8_t ready_tail;
+	uint16_t timeout;               // Ticks without TWI interrupt before the bus is recovered
+	uint16_t wait_timeout;          // Same while a START waits for the bus, I2C_BUS_WAIT_FACTOR * timeout
+	uint16_t watchdog_ticks;
+	volatile uint8_t waiting;       // START requested, not on the bus yet, see wait_timeout
+	uint8_t internal_pullups;
+	uint8_t deferred;
+	uint8_t twbr;                   // Bus speed from i2c_init(), used by devices without their own
+	uint8_t twps;
+	uint32_t scl_target_frequency;
+#if I2C_SLAVE
+	i2c_slave_t slave;
+	uint8_t twea;                   // (1 << TWEA) while a register map is attached
+#endif
+	uint8_t index;                  // TWI controller
+	uint8_t enabled;                // Set by i2c_init()
+} i2c_bus_t;
+
+static i2c_bus_t buses[I2C_BUSES];
+
+/*
+ * Completion ring of pool indices in deferred mode, filled by the ISR side and
+ * drained by i2c_process_completions(). A transfer is queued at most once
+ * (I2C_TRANSFER_COMPLETING), so one slot more than the pool never overflows.
+ */
+#define I2C_COMPLETION_SIZE (I2C_PAYLOAD_POOL_SIZE + 1)
+
+static volatile uint8_t completion[I2C_COMPLETION_SIZE];
+static volatile uint8_t completion_head;  // Written by the ISR side
+static volatile uint8_t completion_tail;  // Written by the thread
+
+static volatile uint16_t ticks;
+
+#if I2C_STATS
+static i2c_stats_t stats;
+
+// Default time base for latencies is the tick counter
+#ifndef I2C_STATS_TIMESTAMP
+#define I2C_STATS_TIMESTAMP() ticks
+#endif
+#endif
+
+static i2c_transfer_t pool[I2C_PAYLOAD_POOL_SIZE];
+static uint8_t pool_head;
+static uint8_t pool_in_use;
+static uint8_t pool_high_water_mark;
+
+#if I2C_PERIODIC_JOBS
+static i2c_job_t jobs[I2C_PERIODIC_JOBS];
+#endif
 
 // Define CPU frequency in Hz here if not defined in Makefile
 #ifndef F_CPU
 #define F_CPU 10000000UL // Hz
 #endif
 
+#include <util/delay.h>
+
+// Bus recovery drives SDA/SCL as open-drain GPIOs
+#define I2C_RECOVERY_HALF_PERIOD_US 5 // ~100 kHz
+
+#define I2C_LINE_LOW(pin)		do { I2C_BUS_PORT(I2C_INDEX(bus)) &= ~(1 << (pin)); I2C_BUS_DDR(I2C_INDEX(bus)) |= (1 << (pin)); } while (0)
+#define I2C_LINE_RELEASE(pin)	do { I2C_BUS_DDR(I2C_INDEX(bus)) &= ~(1 << (pin)); if (bus->internal_pullups) { I2C_BUS_PORT(I2C_INDEX(bus)) |= (1 << (pin)); } } while (0)
+
+/*
+ * TWBR is rounded up, so SCL never runs faster than f_scl. Targets out of reach
+ * get the nearest rate, see i2c_bus_frequency() for what was achieved.
+ */
 static uint8_t i2c_select_prescaler(uint32_t f_cpu, uint32_t f_scl, uint8_t* selected_prescaler) {
 	static const uint8_t prescaler_values[] = {1, 4, 16, 64};
-	uint8_t best_prescaler = 0;  // Default to 1 (TWSR = 0)
-	uint8_t twbr = 255;          // Start with max TWBR
+
+	*selected_prescaler = 0;
+
+	// Above F_CPU / 16: as fast as the TWI gets
+	if (f_scl == 0 || f_cpu <= 16 * f_scl) {
+		return 0;
+	}
 
 	for (uint8_t i = 0; i < ARRAY_LEN(prescaler_values); i++) {
-		int32_t temp_twbr = (int32_t)(f_cpu - (16 * f_scl)) / (int32_t)(2 * prescaler_values[i] * f_scl);
+		uint32_t divider = 2UL * prescaler_values[i] * f_scl;
+		uint32_t temp_twbr = (f_cpu - (16 * f_scl) + divider - 1) / divider;
+
+		if (temp_twbr <= 255) { // Ensure TWBR fits within 8-bit register
+			*selected_prescaler = i;
+			return (uint8_t)temp_twbr; // Stop checking larger prescalers
+		}
+	}
+
+	// Below the slowest rate
+	*selected_prescaler = ARRAY_LEN(prescaler_values) - 1;
+	return 255;
+}
+
+/* SCL frequency produced by the bit rate settings */
+static uint32_t _i2c_scl_frequency(uint8_t twbr, uint8_t prescaler) {
+
+	return F_CPU / (16 + 2UL * twbr * (1UL << (2 * prescaler)));
+}
+
+static void _i2c_pool_init(void) {
+
+	for (uint8_t i = 0; i < I2C_PAYLOAD_POOL_SIZE; i++) {
+		pool[i].next = i + 1;
+	}
+
+	pool[I2C_PAYLOAD_POOL_SIZE - 1].next = I2C_POOL_END;
+	pool_head = 0;
+	pool_in_use = 0;
+	pool_high_water_mark = 0;
+}
+
+/*
+ * O(1) pop from the free list. Thread and ISRs both pop and push, which takes a
+ * compare-and-swap the AVR does not have, so the list is guarded by a short
+ * atomic block instead. It is a no-op when called from an ISR.
+ */
+static i2c_transfer_t* _i2c_pool_acquire(void) {
+
+	i2c_transfer_t* transfer = NULL;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (pool_head != I2C_POOL_END) {
+			transfer = &pool[pool_head];
+			pool_head = transfer->next;
+
+			if (++pool_in_use > pool_high_water_mark) {
+				pool_high_water_mark = pool_in_use;
+			}
+		}
+	}
+
+	// Owned once popped, cleared with interrupts enabled
+	if (transfer != NULL) {
+		memset(transfer, 0, sizeof(i2c_transfer_t));
+	}
+
+	return transfer;
+}
+
+/* O(1) push onto the free list. */
+static void _i2c_pool_release(i2c_transfer_t* transfer) {
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		transfer->next = pool_head;
+		pool_head = (uint8_t)(transfer - pool);
+		pool_in_use--;
+	}
+}
+
+static uint8_t _i2c_pool_owns(payload_t* _payload) {
+
+	return (i2c_transfer_t*)_payload >= &pool[0] && (i2c_transfer_t*)_payload < &pool[I2C_PAYLOAD_POOL_SIZE];
+}
+
+/*
+ * Moves a heap payload from payload_create_i2c() into the pool, so the ISR
+ * only ever releases pool entries. The heap is touched here, in thread context.
+ * The heap payload is consumed even if the pool is empty.
+ */
+static i2c_transfer_t* _i2c_adopt_payload(payload_t* _payload) {
+
+	i2c_transfer_t* transfer;
+
+	if (_i2c_pool_owns(_payload)) {
+		return (i2c_transfer_t*)_payload;
+	}
+
+	transfer = _i2c_pool_acquire();
+
+	if (transfer != NULL) {
+		transfer->payload = *_payload;
+		transfer->length = _payload->i2c.number_of_bytes;
+	}
+
+	payload_free_i2c(_payload);
+
+	return transfer;
+}
+
+#if I2C_STATS
+/* Counts the result globally and for the device, and files the latency in the histogram. */
+static void _i2c_stats_record(i2c_transfer_t* transfer, i2c_error_t result) {
+
+	device_t* device = transfer->payload.i2c.device;
+	uint16_t latency = (uint16_t)(I2C_STATS_TIMESTAMP() - transfer->submitted_at);
+	uint8_t bucket = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		stats.bytes += transfer->transferred;
+
+		switch (result) {
+			case I2C_NO_ERROR:         stats.completed++; device->stats.completed++; break;
+			case I2C_ERROR_ADDR_NACK:  stats.addr_nacks++; device->stats.nacks++; break;
+			case I2C_ERROR_DATA_NACK:  stats.data_nacks++; device->stats.nacks++; break;
+			case I2C_ERROR_ARB_LOST:   stats.arb_lost++; device->stats.arb_lost++; break;
+			case I2C_ERROR_TIMEOUT:    stats.timeouts++; device->stats.errors++; break;
+			case I2C_ERROR_QUEUE_FULL: stats.queue_full++; device->stats.errors++; break;
+			default:                   stats.bus_errors++; device->stats.errors++; break;
+		}
+
+		while (latency >> bucket && bucket < I2C_STATS_LATENCY_BUCKETS - 1) {
+			bucket++;
+		}
+
+		stats.latency[bucket]++;
+
+		if (latency > device->stats.max_latency) {
+			device->stats.max_latency = latency;
+		}
+	}
+}
+#endif
+
+#if I2C_PERIODIC_JOBS
+/* Publishes a good sample by swapping the halves. */
+static void _i2c_job_complete(i2c_job_t* job, i2c_error_t result) {
+
+	if (result == I2C_NO_ERROR) {
+		job->front ^= 1;
+		job->sequence++;
+	}
+
+	job->result = result;
+}
+#endif
+
+/* Records the result. Tracked transfers are released by the handle owner instead. */
+static void _i2c_finish(i2c_transfer_t* transfer, i2c_error_t result) {
+
+#if I2C_STATS
+	_i2c_stats_record(transfer, result);
+#endif
+
+#if I2C_PERIODIC_JOBS
+	if (transfer->flags & I2C_TRANSFER_PERIODIC) {
+		_i2c_job_complete(&jobs[transfer->job], result);
+		transfer->status = result;
+		return;
+	}
+#endif
+
+	transfer->status = result;
+
+	// A queued completion releases the transfer once its callbacks ran
+	if (!(transfer->flags & (I2C_TRANSFER_TRACKED | I2C_TRANSFER_COMPLETING))) {
+		_i2c_pool_release(transfer);
+	}
+}
+
+/* Calls the payload callback, then the context callback. */
+static void _i2c_notify(i2c_transfer_t* transfer, i2c_error_t result) {
+
+	if (transfer->payload.i2c.callback != NULL) {
+		transfer->payload.i2c.callback(&transfer->payload);
+	}
+
+	if (transfer->callback != NULL) {
+		transfer->callback(transfer->context, result);
+	}
+}
+
+/* Bus the transfer runs on, bound by its device */
+static i2c_bus_t* _i2c_bus(i2c_transfer_t* transfer) {
+
+#if I2C_BUSES > 1
+	return &buses[transfer->payload.i2c.device->bus];
+#else
+	return &buses[0];
+#endif
+}
+
+static uint8_t _i2c_level(i2c_bus_t* bus, i2c_transfer_t* transfer) {
+
+	uint8_t priority = (uint8_t)transfer->payload.priority;
+
+	if (bus->scheduler == I2C_SCHED_FIFO) {
+		return 0;
+	}
+
+	return (priority < I2C_PRIORITY_LEVELS) ? priority : I2C_PRIORITY_LEVELS - 1;
+}
+
+static uint8_t _i2c_ring_empty(i2c_bus_t* bus, uint8_t level) {
+
+	return bus->ring_tail[level] == bus->ring_head[level];
+}
+
+static uint8_t _i2c_queue_depth(i2c_bus_t* bus) {
+
+	uint8_t depth = 0;
+
+	for (uint8_t level = 0; level < I2C_PRIORITY_LEVELS; level++) {
+		depth += (uint8_t)(bus->ring_head[level] - bus->ring_tail[level]);
+	}
+
+	return depth;
+}
+
+/* Producer side of the rings, thread context only. */
+static uint8_t _i2c_enqueue(i2c_bus_t* bus, i2c_transfer_t* transfer) {
+
+	uint8_t level = _i2c_level(bus, transfer);
+	uint8_t head = bus->ring_head[level];
+
+	if ((uint8_t)(head - bus->ring_tail[level]) == I2C_QUEUE_SIZE) {
+		return 1;
+	}
+
+	bus->ring[level][head & (I2C_QUEUE_SIZE - 1)] = (uint8_t)(transfer - pool);
+
+	I2C_BARRIER();
+
+	bus->ring_head[level] = head + 1;
+
+#if I2C_STATS
+	uint8_t depth = _i2c_queue_depth(bus);
+
+	if (depth > stats.max_queue_depth) {
+		stats.max_queue_depth = depth;
+	}
+#endif
+
+	return 0;
+}
+
+/*
+ * Strict priority. A waiting level that was passed over .aging times is served
+ * next, so low priority traffic still gets a bounded latency.
+ */
+static uint8_t _i2c_schedule_strict(i2c_bus_t* bus) {
+
+	uint8_t selected = I2C_POOL_END;
+
+	for (int8_t level = I2C_PRIORITY_LEVELS - 1; level >= 0; level--) {
+		if (_i2c_ring_empty(bus, level)) {
+			bus->waited[level] = 0;
+		} else if (bus->aging != 0 && bus->waited[level] >= bus->aging) {
+			selected = level;
+			break;
+		} else if (selected == I2C_POOL_END) {
+			selected = level;
+		}
+	}
+
+	if (selected == I2C_POOL_END) {
+		return selected;
+	}
+
+	for (uint8_t level = 0; level < selected; level++) {
+		if (!_i2c_ring_empty(bus, level)) {
+			bus->waited[level]++;
+		}
+	}
+
+	bus->waited[selected] = 0;
+
+	return selected;
+}
+
+/* Weighted round-robin. A round ends once no queued level has credit left. */
+static uint8_t _i2c_schedule_wrr(i2c_bus_t* bus) {
+
+	for (uint8_t round = 0; round < 2; round++) {
+		for (int8_t level = I2C_PRIORITY_LEVELS - 1; level >= 0; level--) {
+			if (bus->credit[level] != 0 && !_i2c_ring_empty(bus, level)) {
+				bus->credit[level]--;
+				return level;
+			}
+		}
+
+		for (uint8_t level = 0; level < I2C_PRIORITY_LEVELS; level++) {
+			bus->credit[level] = 1 << level;
+		}
+	}
+
+	return I2C_POOL_END;
+}
+
+/* Consumer side, TWI and tick ISR only. Due retries go first, then the scheduled ring. */
+static payload_t* _i2c_dequeue(i2c_bus_t* bus) {
+
+	i2c_transfer_t* transfer;
+	uint8_t level;
+	uint8_t tail;
+
+#if I2C_POLLED
+	// A polled transfer ends with a STOP, queued work is started afterwards
+	if (bus->polling) {
+		return NULL;
+	}
+#endif
+
+	if (bus->ready_head != I2C_POOL_END) {
+		transfer = &pool[bus->ready_head];
+		bus->ready_head = transfer->next;
+		return &transfer->payload;
+	}
+
+	switch (bus->scheduler) {
+		case I2C_SCHED_STRICT: level = _i2c_schedule_strict(bus); break;
+		case I2C_SCHED_WRR:    level = _i2c_schedule_wrr(bus); break;
+		default:               level = _i2c_ring_empty(bus, 0) ? I2C_POOL_END : 0; break;
+	}
+
+	if (level == I2C_POOL_END) {
+		return NULL;
+	}
+
+	tail = bus->ring_tail[level];
+	transfer = &pool[bus->ring[level][tail & (I2C_QUEUE_SIZE - 1)]];
+
+	bus->ring_tail[level] = tail + 1;
+
+	return &transfer->payload;
+}
+
+/* Programs the bit rate of the device, or the bus speed if it has none (or is NULL). */
+static void _i2c_set_speed(i2c_bus_t* bus, device_t* device) {
+
+	uint8_t twbr = bus->twbr;
+	uint8_t twps = bus->twps;
+
+	if (device != NULL && (device->twps & I2C_SPEED_SET)) {
+		twbr = device->twbr;
+		twps = device->twps & 0x03;
+	}
+
+	I2C_TWBR(I2C_INDEX(bus)) = twbr;
+	I2C_TWSR(I2C_INDEX(bus)) = (I2C_TWSR(I2C_INDEX(bus)) & ~0x03) | twps;
+}
+
+/*
+ * Takes the next payload and switches to the speed of its device. Every
+ * payload is taken right before its START, or right after a START issued
+ * without a payload, which goes out at the bus speed.
+ */
+static payload_t* _isr_i2c_next(i2c_bus_t* bus) {
+
+	payload_t* payload = _i2c_dequeue(bus);
+
+	if (payload != NULL) {
+		_i2c_set_speed(bus, payload->i2c.device);
+	}
+
+	return payload;
+}
+
+static uint8_t _i2c_pending(i2c_bus_t* bus) {
+
+	return bus->ready_head != I2C_POOL_END || _i2c_queue_depth(bus) != 0;
+}
+
+/* Selects RAM or flash as the source of the data to transmit. */
+static void _i2c_set_source(i2c_transfer_t* transfer, uint8_t segment_flags) {
+
+	transfer->flags &= ~(I2C_TRANSFER_FLASH | I2C_TRANSFER_FAR);
+
+	if (segment_flags & I2C_SEGMENT_FLASH) {
+		transfer->flags |= I2C_TRANSFER_FLASH;
+	}
+
+	if (segment_flags & I2C_SEGMENT_FAR) {
+		transfer->flags |= I2C_TRANSFER_FLASH | I2C_TRANSFER_FAR;
+	}
+}
+
+/* The stream continues the last segment, the loaded bytes are its first chunk. */
+static void _i2c_begin_stream(i2c_transfer_t* transfer) {
+
+	transfer->stream_left = 0;
+
+	if (transfer->number_of_segments == 0 && transfer->stream_length > transfer->remaining) {
+		transfer->stream_left = transfer->stream_length - transfer->remaining;
+	}
+}
+
+/* Restores the transfer to the state it was submitted in. */
+static void _i2c_rewind(i2c_transfer_t* transfer) {
+
+	transfer->cursor = transfer->origin.data;
+	transfer->remaining = transfer->origin.number_of_bytes;
+	transfer->payload.i2c.mode = (transfer->origin.flags & I2C_SEGMENT_READ) ? READ : WRITE;
+	transfer->segments = transfer->origin_segments;
+	transfer->number_of_segments = transfer->origin_number_of_segments;
+	transfer->transferred = 0;
+	transfer->watermark_left = transfer->watermark;
+
+	_i2c_set_source(transfer, transfer->origin.flags);
+	_i2c_begin_stream(transfer);
+}
+
+/* Points the cursor at the payload data. */
+static void _i2c_load_payload(i2c_transfer_t* transfer) {
+
+	transfer->cursor = transfer->payload.i2c.data;
+	transfer->remaining = transfer->length;
+}
+
+/* Loads the next segment into the cursor, so the ISR walks it without copying. */
+static uint8_t _i2c_load_segment(i2c_transfer_t* transfer) {
+
+	i2c_segment_t* segment = transfer->segments++;
+
+	transfer->number_of_segments--;
+
+	transfer->cursor = segment->data;
+	transfer->remaining = segment->number_of_bytes;
+	transfer->payload.i2c.mode = (segment->flags & I2C_SEGMENT_READ) ? READ : WRITE;
+
+	_i2c_set_source(transfer, segment->flags);
+	_i2c_begin_stream(transfer);
+
+	return segment->flags;
+}
+
+/*
+ * Loads the next register table record: address, length, data, delay. The data
+ * is sent straight from flash. The record becomes the origin, so a retry
+ * repeats the record, not the table. Returns 0 at the end of the table.
+ */
+static uint8_t _i2c_load_record(i2c_transfer_t* transfer) {
+
+	const uint8_t* record = transfer->table;
+	uint8_t address = pgm_read_byte(record);
+	uint8_t length;
+
+	if (address == I2C_TABLE_END) {
+		return 0;
+	}
+
+	length = pgm_read_byte(record + 1);
+
+	transfer->address = address;
+	transfer->cursor = (uint8_t*)(record + 2);
+	transfer->remaining = length;
+	transfer->payload.i2c.mode = WRITE;
+	transfer->record_delay = pgm_read_byte(record + 2 + length);
+	transfer->table = record + 3 + length;
+
+	transfer->origin.data = transfer->cursor;
+	transfer->origin.number_of_bytes = length;
+
+	return 1;
+}
+
+payload_t* i2c_payload_create(priority_t priority, device_t* device, uint8_t* data, uint16_t number_of_bytes, callback_fn callback) {
+
+	i2c_transfer_t* transfer = _i2c_pool_acquire();
+
+	if (transfer == NULL) {
+		return NULL;
+	}
+
+	transfer->payload.priority = priority;
+	transfer->payload.i2c.device = device;
+	transfer->payload.i2c.data = data;
+	transfer->payload.i2c.number_of_bytes = (uint8_t)number_of_bytes;
+	transfer->payload.i2c.callback = callback;
+	transfer->length = number_of_bytes;
+
+	return &transfer->payload;
+}
+
+/* Walks the table once, 0 if it is empty or a record has no data. The ISR relies on every length being set. */
+static uint8_t _i2c_table_valid(const uint8_t* table) {
+
+	uint8_t length;
+
+	if (pgm_read_byte(table) == I2C_TABLE_END) {
+		return 0;
+	}
+
+	while (pgm_read_byte(table) != I2C_TABLE_END) {
+		length = pgm_read_byte(table + 1);
+
+		if (length == 0) {
+			return 0;
+		}
+
+		table += 3 + length;
+	}
 
-		if (temp_twbr <= 255 && temp_twbr >= 0) { // Ensure TWBR fits within 8-bit register
-			best_prescaler = i; 
-			twbr = temp_twbr;   
-			break; // Stop checking larger prescalers
+	return 1;
+}
+
+payload_t* i2c_payload_create_table(priority_t priority, device_t* device, const uint8_t* table, callback_fn callback) {
+
+	i2c_transfer_t* transfer;
+
+	if (device == NULL || table == NULL || !_i2c_table_valid(table) || (transfer = _i2c_pool_acquire()) == NULL) {
+		return NULL;
+	}
+
+	transfer->payload.priority = priority;
+	transfer->payload.i2c.device = device;
+	transfer->payload.i2c.callback = callback;
+	transfer->flags = I2C_TRANSFER_TABLE | I2C_TRANSFER_FLASH;
+	transfer->table = table;
+
+	_i2c_load_record(transfer);
+
+	// The first record is the payload data for i2c_write()
+	transfer->payload.i2c.data = transfer->cursor;
+	transfer->length = transfer->remaining;
+
+	return &transfer->payload;
+}
+
+i2c_error_t i2c_payload_free(payload_t* _payload) {
+
+	if (!_i2c_pool_owns(_payload)) {
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+
+	_i2c_pool_release((i2c_transfer_t*)_payload);
+
+	return I2C_NO_ERROR;
+}
+
+payload_t* i2c_payload_create_P(priority_t priority, device_t* device, const uint8_t* data, uint16_t number_of_bytes, callback_fn callback) {
+
+	payload_t* _payload = i2c_payload_create(priority, device, (uint8_t*)data, number_of_bytes, callback);
+
+	if (_payload != NULL) {
+		((i2c_transfer_t*)_payload)->flags |= I2C_TRANSFER_FLASH;
+	}
+
+	return _payload;
+}
+
+#if I2C_FAR_FLASH
+payload_t* i2c_payload_create_far(priority_t priority, device_t* device, uint_farptr_t data, uint16_t number_of_bytes, callback_fn callback) {
+
+	// The ISR advances the cursor as offset from data, starting from 0
+	payload_t* _payload = i2c_payload_create(priority, device, NULL, number_of_bytes, callback);
+
+	if (_payload != NULL) {
+		((i2c_transfer_t*)_payload)->far_data = data;
+		((i2c_transfer_t*)_payload)->flags |= I2C_TRANSFER_FLASH | I2C_TRANSFER_FAR;
+	}
+
+	return _payload;
+}
+#endif
+
+uint8_t i2c_payload_high_water_mark(void) {
+
+	return pool_high_water_mark;
+}
+
+i2c_error_t i2c_init(i2c_config_t* config) {
+    
+	if (!config || config->bus >= I2C_BUSES || ((config->mode & I2C_SLAVE_MODE) && (!I2C_SLAVE || config->slave == NULL))) {
+		return I2C_ERROR_NULL_CONFIG;
+	}
+	
+	i2c_bus_t* bus = &buses[config->bus];
+	uint8_t shared = 1;
+	uint8_t prescaler;
+	uint32_t scl_target_frequency = config->scl_target_frequency;
+	
+	bus->index = config->bus;
+	
+	// Activate Internal Pullups if enabled
+	if (config->internal_pullups) {
+		SET_PIN_OUTPUT(I2C_BUS_PORT(I2C_INDEX(bus)), I2C_BUS_SDA(I2C_INDEX(bus)));
+		SET_PIN_OUTPUT(I2C_BUS_PORT(I2C_INDEX(bus)), I2C_BUS_SCL(I2C_INDEX(bus)));
+	}
+	
+#if defined(I2C_SCL_FREQUENCY)
+	// Resolved at compile time, see i2c_config.h
+	scl_target_frequency = I2C_SCL_FREQUENCY;
+	prescaler = I2C_SCL_TWPS;
+	I2C_TWBR(I2C_INDEX(bus)) = I2C_SCL_TWBR;
+#else
+	// Auto-select the best prescaler & calculate TWBR
+	I2C_TWBR(I2C_INDEX(bus)) = i2c_select_prescaler(F_CPU, scl_target_frequency, &prescaler);
+#endif
+	
+	// Set prescaler bits in TWSR
+	I2C_TWSR(I2C_INDEX(bus)) = (I2C_TWSR(I2C_INDEX(bus)) & ~0x03) | prescaler; 
+	
+	// Restored before each device without a speed of its own
+	bus->twbr = I2C_TWBR(I2C_INDEX(bus));
+	bus->twps = prescaler;
+	bus->scl_target_frequency = scl_target_frequency;
+	
+#if I2C_SLAVE
+	memset(&bus->slave, 0, sizeof(bus->slave));
+	bus->twea = 0;
+	
+	if (config->mode & I2C_SLAVE_MODE) {
+		bus->slave.regs = config->slave->regs;
+		bus->slave.write_mask = config->slave->write_mask;
+		bus->slave.size = config->slave->size;
+		bus->slave.callback = config->slave->callback;
+		I2C_TWAR(I2C_INDEX(bus)) = (uint8_t)(config->slave->address << 1);
+		bus->twea = (1 << TWEA);
+	}
+#endif
+		 
+	I2C_TWCR_INIT();
+	
+    bus->state = I2C_INACTIVE;
+	
+	bus->chain_limit = config->chain_limit;
+	bus->chain_length = 0;
+	
+	bus->timeout = config->timeout;
+	bus->wait_timeout = (uint32_t)config->timeout * I2C_BUS_WAIT_FACTOR > UINT16_MAX ? UINT16_MAX : config->timeout * I2C_BUS_WAIT_FACTOR;
+	bus->watchdog_ticks = 0;
+	bus->waiting = 0;
+	bus->internal_pullups = config->internal_pullups;
+    
+	bus->payload = NULL;
+	bus->kicking = 0;
+#if I2C_POLLED
+	bus->twie = (1 << TWIE);
+	bus->polling = 0;
+#endif
+	bus->deferred = config->deferred;
+	bus->scheduler = config->scheduler;
+	bus->aging = config->aging;
+	memset((void*)bus->ring_head, 0, sizeof(bus->ring_head));
+	memset((void*)bus->ring_tail, 0, sizeof(bus->ring_tail));
+	memset(bus->waited, 0, sizeof(bus->waited));
+	memset(bus->credit, 0, sizeof(bus->credit));
+	bus->retry_head = I2C_POOL_END;
+	bus->ready_head = I2C_POOL_END;
+	bus->ready_tail = I2C_POOL_END;
+	
+	// Pool, jobs and statistics are shared, they are kept while another bus runs
+	for (uint8_t i = 0; i < I2C_BUSES; i++) {
+		if (i != config->bus && buses[i].enabled) {
+			shared = 0;
+		}
+	}
+	
+	if (shared) {
+		_i2c_pool_init();
+		completion_head = 0;
+		completion_tail = 0;
+		
+#if I2C_PERIODIC_JOBS
+		memset(jobs, 0, sizeof(jobs));
+#endif
+		
+#if I2C_STATS
+		memset(&stats, 0, sizeof(stats));
+#endif
+	}
+	
+	bus->enabled = 1;
+	
+    return I2C_NO_ERROR;
+}
+
+/*
+ * Starts the bus if it is idle. The payload is taken from the ring once the
+ * START is on the bus, so the thread never dequeues. While the flag is set the
+ * ISRs leave an idle bus alone, the next i2c_tick() picks up what they skipped.
+ */
+static void _i2c_start(i2c_bus_t* bus) {
+	
+#if I2C_SLAVE
+	// The TWI may be addressed at any time, a set TWINT is a slave transfer not yet served
+	if (bus->slave.regs != NULL) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (bus->state == I2C_INACTIVE && !(I2C_TWCR(I2C_INDEX(bus)) & (1 << TWINT))) {
+				bus->state = I2C_ACTIVE;
+				_i2c_set_speed(bus, NULL);
+				I2C_TX_START();
+			}
+		}
+		
+		return;
+	}
+#endif
+	
+    if (bus->state == I2C_INACTIVE) {
+        
+        bus->state = I2C_ACTIVE;
+		
+		_i2c_set_speed(bus, NULL);
+		
+        I2C_TX_START();      
+    }
+}
+
+i2c_error_t _i2c(i2c_bus_t* bus) {
+
+	bus->kicking = 1;
+	
+	_i2c_start(bus);
+	
+	bus->kicking = 0;
+    
+    return I2C_NO_ERROR;
+}
+
+/* Starts the bus from ISR context, unless the thread is just doing so. */
+static void _isr_i2c_kick(i2c_bus_t* bus) {
+	
+	if (!bus->kicking && _i2c_pending(bus)) {
+		_i2c_start(bus);
+	}
+}
+
+/* Remembers the submitted state for retries and starts from it. */
+static void _i2c_prepare(i2c_transfer_t* transfer) {
+	
+	transfer->origin.data = transfer->cursor;
+	transfer->origin.number_of_bytes = transfer->remaining;
+	transfer->origin.flags = (transfer->payload.i2c.mode == READ) ? I2C_SEGMENT_READ : I2C_SEGMENT_WRITE;
+	transfer->origin_segments = transfer->segments;
+	transfer->origin_number_of_segments = transfer->number_of_segments;
+	
+	if (transfer->flags & I2C_TRANSFER_FAR) {
+		transfer->origin.flags |= I2C_SEGMENT_FAR;
+	} else if (transfer->flags & I2C_TRANSFER_FLASH) {
+		transfer->origin.flags |= I2C_SEGMENT_FLASH;
+	}
+	
+	_i2c_rewind(transfer);
+	
+	// Table records carry their own address
+	if (!(transfer->flags & I2C_TRANSFER_TABLE)) {
+		transfer->address = transfer->payload.i2c.device->address;
+	}
+	
+	transfer->arb_losses = 0;
+	
+#if I2C_STATS
+	transfer->submitted_at = I2C_STATS_TIMESTAMP();
+#endif
+}
+
+/* Adds the read phase of a write/read transfer. */
+static void _i2c_set_read_phase(i2c_transfer_t* transfer, uint8_t* rx_data, uint16_t rx_bytes) {
+	
+	if (rx_bytes != 0) {
+		transfer->read_segment.data = rx_data;
+		transfer->read_segment.number_of_bytes = rx_bytes;
+		transfer->read_segment.flags = I2C_SEGMENT_READ;
+		
+		transfer->segments = &transfer->read_segment;
+		transfer->number_of_segments = 1;
+	}
+}
+
+/* Empty data or segments would underflow the 16-bit byte count in the ISR. */
+static uint8_t _i2c_empty(i2c_transfer_t* transfer) {
+	
+	if (transfer->remaining == 0) {
+		return 1;
+	}
+	
+	for (uint8_t i = 0; i < transfer->number_of_segments; i++) {
+		if (transfer->segments[i].number_of_bytes == 0) {
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+static i2c_error_t _i2c_submit(i2c_transfer_t* transfer) {
+	
+	i2c_bus_t* bus = _i2c_bus(transfer);
+	
+	if (_i2c_empty(transfer)) {
+		_i2c_finish(transfer, I2C_ERROR_INVALID_PAYLOAD);
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	_i2c_prepare(transfer);
+	
+	if (_i2c_enqueue(bus, transfer)) {
+		_i2c_finish(transfer, I2C_ERROR_QUEUE_FULL);
+		return I2C_ERROR_QUEUE_FULL;
+	}
+	
+	return _i2c(bus);
+}
+
+i2c_error_t i2c_read(payload_t* _payload) {   
+    
+	i2c_transfer_t* transfer = _i2c_adopt_payload(_payload);
+	
+	if (transfer == NULL) {
+		return I2C_ERROR_POOL_EMPTY;
+	}
+	
+	// Flash is transmit only
+	if (transfer->flags & I2C_TRANSFER_FLASH) {
+		_i2c_finish(transfer, I2C_ERROR_INVALID_PAYLOAD);
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+    transfer->payload.i2c.mode = READ;
+	
+	_i2c_load_payload(transfer);
+    
+    return _i2c_submit(transfer);
+}
+
+i2c_error_t i2c_write(payload_t* _payload) {   
+    
+	i2c_transfer_t* transfer = _i2c_adopt_payload(_payload);
+	
+	if (transfer == NULL) {
+		return I2C_ERROR_POOL_EMPTY;
+	}
+
+	transfer->payload.i2c.mode = WRITE; 
+	
+	_i2c_load_payload(transfer);
+
+    return _i2c_submit(transfer);
+}
+
+i2c_error_t i2c_write_read(payload_t* _payload, uint8_t* rx_data, uint16_t rx_bytes) {
+
+	i2c_transfer_t* transfer = _i2c_adopt_payload(_payload);
+	
+	if (transfer == NULL) {
+		return I2C_ERROR_POOL_EMPTY;
+	}
+	
+	transfer->payload.i2c.mode = WRITE;
+	
+	_i2c_load_payload(transfer);
+	_i2c_set_read_phase(transfer, rx_data, rx_bytes);
+	
+	return _i2c_submit(transfer);
+}
+
+i2c_error_t i2c_transfer(payload_t* _payload, i2c_segment_t* segments, uint8_t number_of_segments) {
+
+	i2c_transfer_t* transfer = _i2c_adopt_payload(_payload);
+	
+	if (transfer == NULL) {
+		return I2C_ERROR_POOL_EMPTY;
+	}
+	
+	if (segments == NULL || number_of_segments == 0) {
+		_i2c_finish(transfer, I2C_ERROR_INVALID_PAYLOAD);
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	transfer->segments = segments;
+	transfer->number_of_segments = number_of_segments;
+	
+	_i2c_load_segment(transfer);
+	
+	return _i2c_submit(transfer);
+}
+
+i2c_error_t i2c_payload_result(payload_t* _payload) {
+	
+	return ((i2c_transfer_t*)_payload)->status;
+}
+
+uint32_t i2c_payload_transferred(payload_t* _payload) {
+	
+	return ((i2c_transfer_t*)_payload)->transferred;
+}
+
+i2c_handle_t i2c_track(payload_t* _payload) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)_payload;
+	
+	if (!_i2c_pool_owns(_payload)) {
+		return NULL;
+	}
+	
+	transfer->status = I2C_ERROR_BUSY;
+	transfer->flags |= I2C_TRANSFER_TRACKED;
+	
+	return transfer;
+}
+
+i2c_error_t i2c_poll(i2c_handle_t handle) {
+	
+	i2c_error_t status = handle->status;
+	
+	if (status != I2C_ERROR_BUSY) {
+		// Runs the callbacks first, the ring must not keep a released entry
+		if (handle->flags & I2C_TRANSFER_COMPLETING) {
+			i2c_process_completions();
+		}
+		
+		_i2c_pool_release(handle);
+	}
+	
+	return status;
+}
+
+/* Sleeps in idle mode until the next interrupt, unless the transfer already finished. */
+static void _i2c_sleep(i2c_handle_t handle) {
+	
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	
+	cli();
+	
+	if (handle->status == I2C_ERROR_BUSY) {
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	
+	sei();
+}
+
+i2c_error_t i2c_wait(i2c_handle_t handle) {
+	
+	while (handle->status == I2C_ERROR_BUSY) {
+		_i2c_sleep(handle);
+	}
+	
+	return i2c_poll(handle);
+}
+
+static uint16_t _i2c_ticks(void) {
+	
+	uint16_t now;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		now = ticks;
+	}
+	
+	return now;
+}
+
+i2c_error_t i2c_wait_timeout(i2c_handle_t handle, uint16_t timeout) {
+	
+	uint16_t start = _i2c_ticks();
+	
+	while (handle->status == I2C_ERROR_BUSY) {
+		
+		if ((uint16_t)(_i2c_ticks() - start) >= timeout) {
+			return I2C_ERROR_TIMEOUT;
+		}
+		
+		_i2c_sleep(handle);
+	}
+	
+	return i2c_poll(handle);
+}
+
+i2c_error_t i2c_payload_set_retry(payload_t* _payload, uint8_t max_retries, uint16_t delay, uint8_t flags) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)_payload;
+	
+	if (!_i2c_pool_owns(_payload)) {
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	transfer->retries = max_retries;
+	transfer->retry_delay = (flags & I2C_RETRY_ACK_POLLING) ? 0 : delay;
+	transfer->retry_flags = flags;
+	
+	return I2C_NO_ERROR;
+}
+
+i2c_error_t i2c_payload_set_callback(payload_t* _payload, i2c_callback_t callback, void* context) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)_payload;
+	
+	if (!_i2c_pool_owns(_payload)) {
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	transfer->callback = callback;
+	transfer->context = context;
+	
+	return I2C_NO_ERROR;
+}
+
+uint8_t i2c_process_completions(void) {
+	
+	uint8_t processed = 0;
+	
+	while (completion_tail != completion_head) {
+		
+		i2c_transfer_t* transfer = &pool[completion[completion_tail]];
+		i2c_error_t result;
+		uint8_t flags;
+		
+		// From here on a new completion of a periodic transfer is queued again
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			transfer->flags &= ~I2C_TRANSFER_COMPLETING;
+			result = transfer->status;
+#if I2C_PERIODIC_JOBS
+			// A running job may already be on its next sample
+			if (transfer->flags & I2C_TRANSFER_PERIODIC) {
+				result = jobs[transfer->job].result;
+			}
+#endif
+		}
+		
+		_i2c_notify(transfer, result);
+		
+		completion_tail = (completion_tail + 1 == I2C_COMPLETION_SIZE) ? 0 : completion_tail + 1;
+		processed++;
+		
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			flags = transfer->flags;
+			
+			// Stopped periodic jobs are released here when their last sample was queued
+			if (!(flags & (I2C_TRANSFER_TRACKED | I2C_TRANSFER_PERIODIC)) && transfer->status != I2C_ERROR_BUSY) {
+				_i2c_pool_release(transfer);
+			}
+		}
+	}
+	
+	return processed;
+}
+
+#if I2C_PERIODIC_JOBS
+i2c_periodic_t i2c_periodic_create(device_t* device, uint8_t reg, uint8_t* buffer, uint8_t number_of_bytes, uint16_t period, callback_fn callback) {
+	
+	i2c_job_t* job = NULL;
+	i2c_transfer_t* transfer;
+	
+	if (device == NULL || buffer == NULL || number_of_bytes == 0 || period == 0) {
+		return NULL;
+	}
+	
+	for (uint8_t i = 0; i < I2C_PERIODIC_JOBS && job == NULL; i++) {
+		if (jobs[i].transfer == NULL) {
+			job = &jobs[i];
+		}
+	}
+	
+	if (job == NULL || (transfer = _i2c_pool_acquire()) == NULL) {
+		return NULL;
+	}
+	
+	job->reg = reg;
+	job->buffer = buffer;
+	job->number_of_bytes = number_of_bytes;
+	job->front = 0;
+	job->sequence = 0;
+	job->result = I2C_ERROR_BUSY;
+	job->period = period;
+	job->countdown = 1; // First sample on the next tick
+	job->overruns = 0;
+	
+	transfer->payload.i2c.device = device;
+	transfer->payload.i2c.callback = callback;
+	transfer->address = device->address;
+	transfer->read_segment.number_of_bytes = number_of_bytes;
+	transfer->read_segment.flags = I2C_SEGMENT_READ;
+	transfer->origin.data = &job->reg;
+	transfer->origin.number_of_bytes = 1;
+	transfer->origin.flags = I2C_SEGMENT_WRITE;
+	transfer->origin_segments = &transfer->read_segment;
+	transfer->origin_number_of_segments = 1;
+	transfer->job = (uint8_t)(job - jobs);
+	transfer->flags = I2C_TRANSFER_PERIODIC;
+	
+	// Publish last, the tick ISR arms the job from here on
+	I2C_BARRIER();
+	job->transfer = transfer;
+	
+	return job;
+}
+
+i2c_error_t i2c_periodic_read(i2c_periodic_t job, uint8_t* data) {
+	
+	uint8_t sequence;
+	
+	// The halves swap at most once per period, copy again if it happened meanwhile
+	do {
+		sequence = job->sequence;
+		memcpy(data, job->buffer + job->front * job->number_of_bytes, job->number_of_bytes);
+	} while (sequence != job->sequence);
+	
+	return job->result;
+}
+
+uint16_t i2c_periodic_overruns(i2c_periodic_t job) {
+	
+	uint16_t overruns;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		overruns = job->overruns;
+	}
+	
+	return overruns;
+}
+
+i2c_error_t i2c_periodic_stop(i2c_periodic_t job) {
+	
+	i2c_transfer_t* transfer = job->transfer;
+	
+	if (transfer == NULL) {
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// A pending sample releases the transfer when it completes
+		transfer->flags &= ~I2C_TRANSFER_PERIODIC;
+		
+		if (transfer->status != I2C_ERROR_BUSY && !(transfer->flags & I2C_TRANSFER_COMPLETING)) {
+			_i2c_pool_release(transfer);
+		}
+		
+		job->transfer = NULL;
+	}
+	
+	return I2C_NO_ERROR;
+}
+#endif
+
+i2c_error_t i2c_payload_set_watermark(payload_t* _payload, uint16_t watermark) {
+	
+	if (!_i2c_pool_owns(_payload)) {
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	((i2c_transfer_t*)_payload)->watermark = watermark;
+	
+	return I2C_NO_ERROR;
+}
+
+i2c_error_t i2c_payload_set_stream(payload_t* _payload, i2c_stream_fn stream, uint32_t length) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)_payload;
+	
+	if (!_i2c_pool_owns(_payload) || stream == NULL) {
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	transfer->stream = stream;
+	transfer->stream_length = length;
+	
+	return I2C_NO_ERROR;
+}
+
+device_t* i2c_create_device(uint8_t address) {
+    
+    return i2c_create_bus_device(0, address);
+}
+
+device_t* i2c_create_bus_device(uint8_t bus, uint8_t address) {
+    
+    if (bus >= I2C_BUSES) {
+        return NULL;
+    }
+    
+    device_t* device = (device_t*)malloc(sizeof(device_t));
+    
+    if (device == NULL) {
+        return NULL;
+    }
+    
+    device->address = address; // First 7 bits describe the device address. Last bit := Read/Write
+    device->bus = bus;
+    device->twbr = 0;
+    device->twps = 0; // Bus speed
+	
+#if I2C_STATS
+	memset(&device->stats, 0, sizeof(device->stats));
+#endif
+    
+    return device;
+}
+
+i2c_error_t i2c_device_set_speed(device_t* device, uint32_t scl_frequency) {
+	
+	uint8_t prescaler;
+	
+	if (device == NULL) {
+		return I2C_ERROR_NULL_CONFIG;
+	}
+	
+	if (scl_frequency == 0) {
+		device->twps = 0;
+		return I2C_NO_ERROR;
+	}
+	
+	// Computed once here, the ISR only loads the registers
+	uint8_t twbr = i2c_select_prescaler(F_CPU, scl_frequency, &prescaler);
+	
+	uint32_t bus_frequency = i2c_bus_frequency(device->bus, NULL);
+	
+	// STARTs on an idle bus go out at the bus speed, before the device is known
+	if (bus_frequency == 0 || _i2c_scl_frequency(twbr, prescaler) < bus_frequency) {
+		return I2C_ERROR_INVALID_SPEED;
+	}
+	
+	device->twbr = twbr;
+	device->twps = I2C_SPEED_SET | prescaler;
+	
+	return I2C_NO_ERROR;
+}
+
+uint32_t i2c_bus_frequency(uint8_t index, int16_t* error) {
+	
+	if (index >= I2C_BUSES || !buses[index].enabled) {
+		return 0;
+	}
+	
+	i2c_bus_t* bus = &buses[index];
+	uint32_t achieved = _i2c_scl_frequency(bus->twbr, bus->twps);
+	
+	if (error != NULL) {
+		*error = bus->scl_target_frequency == 0 ? 0 : (int16_t)((int32_t)(achieved * 1000UL / bus->scl_target_frequency) - 1000);
+	}
+	
+	return achieved;
+}
+
+uint32_t i2c_device_frequency(device_t* device) {
+	
+	if (device == NULL || device->bus >= I2C_BUSES) {
+		return 0;
+	}
+	
+	if (device->twps & I2C_SPEED_SET) {
+		return _i2c_scl_frequency(device->twbr, device->twps & 0x03);
+	}
+	
+	return i2c_bus_frequency(device->bus, NULL);
+}
+
+i2c_error_t i2c_free_device(device_t* device) {
+    
+    free(device);  
+    
+    device = NULL;   
+    
+    return I2C_NO_ERROR;
+}
+
+/*
+ * Reports the result to the completion callbacks, at once or in deferred mode
+ * by queueing the transfer for i2c_process_completions().
+ */
+static void _isr_i2c_free_payload(i2c_bus_t* bus, i2c_error_t result) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+	
+	if (bus->payload != NULL) {
+#if I2C_PERIODIC_JOBS
+		uint8_t periodic = transfer->flags & I2C_TRANSFER_PERIODIC;
+#else
+		uint8_t periodic = 0;
+#endif
+		
+		transfer->status = result;
+		
+		// A job publishes its sample before the callback reads it, the transfer stays with the job
+		if (periodic) {
+			_i2c_finish(transfer, result);
+		}
+		
+		if (!bus->deferred) {
+			_i2c_notify(transfer, result);
+		} else if ((transfer->payload.i2c.callback != NULL || transfer->callback != NULL) && !(transfer->flags & I2C_TRANSFER_COMPLETING)) {
+			transfer->flags |= I2C_TRANSFER_COMPLETING;
+			completion[completion_head] = (uint8_t)(transfer - pool);
+			I2C_BARRIER();
+			completion_head = (completion_head + 1 == I2C_COMPLETION_SIZE) ? 0 : completion_head + 1;
+		}
+		
+		// Released after the callbacks ran
+		if (!periodic) {
+			_i2c_finish(transfer, result);
+		}
+		
+		bus->payload = NULL;
+	}
+}
+
+/*
+ * Starts the next queued payload. While below the chain limit the bus is kept
+ * and the payload follows with a repeated START instead of STOP/START.
+ */
+static void _isr_i2c_start_next(i2c_bus_t* bus) {
+	
+	bus->payload = _isr_i2c_next(bus);
+	
+	if (bus->payload != NULL) {
+		if (bus->chain_length < bus->chain_limit) {
+			bus->chain_length++;
+			I2C_TX_REPEAT_START();
+		} else {
+			bus->chain_length = 0;
+			I2C_TX_STOP_START();
+		}
+	} else {
+		bus->chain_length = 0;
+		bus->state = I2C_INACTIVE;
+		I2C_TX_STOP();
+	}
+}
+
+/*
+ * Parks the current payload until i2c_tick() moves it to the ready list after
+ * the given ticks, and hands the bus to the next payload.
+ */
+static void _isr_i2c_park(i2c_bus_t* bus, i2c_transfer_t* transfer, uint16_t delay) {
+	
+	transfer->retry_ticks = delay;
+	transfer->next = bus->retry_head;
+	bus->retry_head = (uint8_t)(transfer - pool);
+	
+	bus->chain_length = 0;
+	
+	bus->payload = _isr_i2c_next(bus);
+	
+	if (bus->payload != NULL) {
+		I2C_TX_STOP_START();
+	} else {
+		bus->state = I2C_INACTIVE;
+		I2C_TX_STOP();
+	}
+}
+
+/*
+ * Applies the retry policy of the current payload. Without a delay the payload
+ * is restarted at once, which also implements ACK polling. Otherwise it is parked
+ * until i2c_tick() requeues it and the bus is handed to the next payload.
+ */
+static uint8_t _isr_i2c_retry(i2c_bus_t* bus, i2c_error_t result) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+	
+	// Stream chunks may already be refilled or drained
+	if (transfer->retries == 0 || transfer->stream != NULL) {
+		return 0;
+	}
+	
+	if ((transfer->retry_flags & I2C_RETRY_ACK_POLLING) && result != I2C_ERROR_ADDR_NACK) {
+		return 0;
+	}
+	
+	transfer->retries--;
+	
+#if I2C_STATS
+	stats.retries++;
+#endif
+	
+	_i2c_rewind(transfer);
+	
+	if (transfer->retry_delay == 0) {
+		I2C_TX_STOP_START();
+		return 1;
+	}
+	
+	_isr_i2c_park(bus, transfer, transfer->retry_delay);
+	
+	if ((transfer->retry_flags & I2C_RETRY_EXPONENTIAL) && transfer->retry_delay < 0x8000) {
+		transfer->retry_delay <<= 1;
+	}
+	
+	return 1;
+}
+
+static void _isr_i2c_no_ack_response(i2c_bus_t* bus, i2c_error_t result) {
+	
+	if (_isr_i2c_retry(bus, result)) {
+		return;
+	}
+	
+	_isr_i2c_free_payload(bus, result);
+	
+	bus->chain_length = 0;
+	
+	bus->payload = _isr_i2c_next(bus);
+	
+	if (bus->payload != NULL) {
+		I2C_TX_STOP_START();
+	} else {
+		bus->state = I2C_INACTIVE;
+		I2C_TX_STOP();	
+	}
+}
+
+static void _isr_i2c_handle_tx_complete(i2c_bus_t* bus) {
+
+	i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+	uint8_t delay = transfer->record_delay;
+	
+	// Register tables keep the bus and go on with the next record
+	if ((transfer->flags & I2C_TRANSFER_TABLE) && _i2c_load_record(transfer)) {
+		if (delay != 0) {
+			_isr_i2c_park(bus, transfer, delay);
+		} else {
+			I2C_TX_REPEAT_START();
+		}
+		
+		return;
+	}
+	
+	_isr_i2c_free_payload(bus, I2C_NO_ERROR);
+	
+	_isr_i2c_start_next(bus);
+}
+
+/* Next byte to transmit, from RAM or flash. */
+static inline uint8_t _isr_i2c_tx_byte(i2c_bus_t* bus) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+	
+	if (transfer->flags & I2C_TRANSFER_FLASH) {
+#if I2C_FAR_FLASH
+		if (transfer->flags & I2C_TRANSFER_FAR) {
+			return pgm_read_byte_far(transfer->far_data + (uint16_t)(uintptr_t)transfer->cursor);
+		}
+#endif
+		return pgm_read_byte(transfer->cursor);
+	}
+	
+	return *(transfer->cursor);
+}
+
+static void _isr_i2c_handle_rx_complete(i2c_bus_t* bus) {
+
+	_isr_i2c_free_payload(bus, I2C_NO_ERROR);
+	
+	_isr_i2c_start_next(bus);
+}
+
+/*
+ * Moves on to the next segment once the current one is done. A write that is
+ * flagged I2C_SEGMENT_NO_RESTART continues right away, everything else is
+ * started with a repeated START.
+ */
+static void _isr_i2c_next_segment(i2c_bus_t* bus) {
+	
+	uint8_t was_write = (bus->payload->i2c.mode == WRITE);
+	uint8_t flags = _i2c_load_segment((i2c_transfer_t*)bus->payload);
+	
+	if (was_write && (flags & (I2C_SEGMENT_READ | I2C_SEGMENT_NO_RESTART)) == I2C_SEGMENT_NO_RESTART) {
+		I2C_TWDR(I2C_INDEX(bus)) = _isr_i2c_tx_byte(bus);
+		I2C_TX_TRANSMIT();
+	} else {
+		I2C_TX_REPEAT_START();
+	}
+}
+
+/* Returns whether another byte follows in the current read, so it must be ACKed. */
+static uint8_t _isr_i2c_rx_continues(i2c_bus_t* bus) {
+	
+	i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+	
+	if (transfer->remaining > 1) {
+		return 1;
+	}
+	
+	if (transfer->number_of_segments == 0) {
+		return transfer->stream_left != 0;
+	}
+	
+	return
+		(transfer->segments->flags & (I2C_SEGMENT_READ | I2C_SEGMENT_NO_RESTART)) == (I2C_SEGMENT_READ | I2C_SEGMENT_NO_RESTART);
+}
+
+/*
+ * Hands a finished chunk of the last segment to the stream hook and loads the
+ * next one. After the last chunk the hook is only called to drain it.
+ */
+static void _isr_i2c_refill(i2c_transfer_t* transfer) {
+	
+	static uint8_t discard;
+	uint8_t* chunk = NULL;
+	uint16_t length = transfer->stream(&transfer->payload, &chunk);
+	
+	if (transfer->stream_left == 0) {
+		return;
+	}
+	
+	if (length > transfer->stream_left) {
+		length = (uint16_t)transfer->stream_left;
+	}
+	
+	if (length == 0) {
+		transfer->stream_left = 0;
+		
+		// The last byte was already ACKed, NACK one more into a scratch byte
+		if (transfer->payload.i2c.mode == READ) {
+			transfer->cursor = &discard;
+			transfer->remaining = 1;
+		}
+		
+		return;
+	}
+	
+	transfer->flags &= ~(I2C_TRANSFER_FLASH | I2C_TRANSFER_FAR);
+	transfer->cursor = chunk;
+	transfer->remaining = length;
+	transfer->stream_left -= length;
+}
+
+/* Progress notification every watermark received bytes. The result still reads I2C_ERROR_BUSY. */
+static inline void _isr_i2c_rx_watermark(i2c_transfer_t* transfer) {
+	
+	if (transfer->watermark != 0 && --transfer->watermark_left == 0) {
+		transfer->watermark_left = transfer->watermark;
+		
+		_i2c_notify(transfer, I2C_ERROR_BUSY);
+	}
+}
+
+#if I2C_SLAVE
+/* Stores a byte written by the master. The first byte of a write selects the register. */
+static inline void _isr_i2c_slave_receive(i2c_bus_t* bus, uint8_t data) {
+	
+	uint8_t mask = 0xFF;
+	
+	if (bus->slave.select) {
+		bus->slave.select = 0;
+		bus->slave.pointer = data;
+		bus->slave.reg = data;
+		return;
+	}
+	
+	// Writes beyond the map are ACKed and dropped
+	if (bus->slave.pointer < bus->slave.size) {
+		if (bus->slave.write_mask != NULL) {
+			mask = bus->slave.write_mask[bus->slave.pointer];
 		}
+		
+		bus->slave.regs[bus->slave.pointer] = (uint8_t)((bus->slave.regs[bus->slave.pointer] & ~mask) | (data & mask));
+		bus->slave.pointer++;
+		bus->slave.written++;
 	}
-
-	*selected_prescaler = best_prescaler;
-	return twbr;
 }
 
-i2c_error_t i2c_init(i2c_config_t* config) {
-    
-	if (!config) {
-		return I2C_ERROR_NULL_CONFIG;
+/* Next byte for the master, 0xFF beyond the map */
+static inline uint8_t _isr_i2c_slave_transmit(i2c_bus_t* bus) {
+	
+	if (bus->slave.pointer < bus->slave.size) {
+		return bus->slave.regs[bus->slave.pointer++];
 	}
 	
-	uint8_t prescaler;
-	uint32_t scl_target_frequency = config->scl_target_frequency;
+	return 0xFF;
+}
+
+/* Ends a slave transfer and starts the payloads that queued up meanwhile. */
+static void _isr_i2c_slave_release(i2c_bus_t* bus) {
 	
-	// Activate Internal Pullups if enabled
-	if (config->internal_pullups) {
-		SET_PIN_OUTPUT(PORTD, SDA);
-		SET_PIN_OUTPUT(PORTD, SCL);
+	if (bus->slave.written != 0 && bus->slave.callback != NULL) {
+		bus->slave.callback(bus->slave.reg, bus->slave.written);
 	}
 	
-	// Auto-select the best prescaler & calculate TWBR
-	TWBR = i2c_select_prescaler(F_CPU, scl_target_frequency, &prescaler);
+	bus->slave.written = 0;
 	
-	// Set prescaler bits in TWSR
-	TWSR = (TWSR & ~0x03) | prescaler; 
+	if (!bus->kicking && _i2c_pending(bus)) {
+		bus->state = I2C_ACTIVE;
+		_i2c_set_speed(bus, NULL);
+		I2C_TX_START();
+	} else {
+		bus->state = I2C_INACTIVE;
+		I2C_SLAVE_ACK();
+	}
+}
+#endif
+
+/* Appends to the ready list, ISR context only. */
+static void _i2c_ready(i2c_bus_t* bus, uint8_t index) {
 	
-	// Calculate the actual SCL frequency
-	int32_t actual_scl_frequency = F_CPU / (16 + (2 * TWBR * (1 << (2 * prescaler))));
-		 
-	I2C_TWCR_INIT();
+	pool[index].next = I2C_POOL_END;
 	
-    I2C_STATE = I2C_INACTIVE;
-    
-    queue = queue_init(&q);
+	if (bus->ready_head == I2C_POOL_END) {
+		bus->ready_head = index;
+	} else {
+		pool[bus->ready_tail].next = index;
+	}
 	
-    return I2C_NO_ERROR;
+	bus->ready_tail = index;
 }
 
-i2c_error_t _i2c() {
-
-    if (I2C_STATE == I2C_INACTIVE) {
-        
-        payload = queue_dequeue(queue);
-        
-        I2C_STATE = I2C_ACTIVE;
-
-        I2C_TX_START();      
-    }
-    
-    return I2C_NO_ERROR;
+#if I2C_SLAVE
+/* Puts the transfer first on the ready list, ISR context only. */
+static void _i2c_ready_front(i2c_bus_t* bus, uint8_t index) {
+	
+	pool[index].next = bus->ready_head;
+	
+	if (bus->ready_head == I2C_POOL_END) {
+		bus->ready_tail = index;
+	}
+	
+	bus->ready_head = index;
 }
+#endif
 
-i2c_error_t i2c_read(payload_t* _payload) {   
-    
-    i2c_error_t err;
+/* Moves parked transfers whose retry delay expired to the ready list. Runs in timer ISR context. */
+static void _i2c_tick_retries(i2c_bus_t* bus) {
 	
-    _payload->i2c.mode = READ;
-    
-    err = queue_enqueue(queue, _payload);
-    
-    err = _i2c();
-    
-    return I2C_NO_ERROR;
+	uint8_t* link = &bus->retry_head;
+	
+	while (*link != I2C_POOL_END) {
+		uint8_t index = *link;
+		i2c_transfer_t* transfer = &pool[index];
+		
+		if (--transfer->retry_ticks != 0) {
+			link = &transfer->next;
+			continue;
+		}
+		
+		*link = transfer->next;
+		
+		_i2c_ready(bus, index);
+	}
 }
 
-i2c_error_t i2c_write(payload_t* _payload) {   
-    
-    i2c_error_t err;
-
-	_payload->i2c.mode = WRITE; 
-
-    err = queue_enqueue(queue, _payload);
-
-    err = _i2c();
-    
-    return I2C_NO_ERROR;
+#if I2C_PERIODIC_JOBS
+/* Re-arms due jobs through the ready list, so they start ahead of the rings. Runs in timer ISR context. */
+static void _i2c_tick_periodic(void) {
+	
+	for (uint8_t i = 0; i < I2C_PERIODIC_JOBS; i++) {
+		i2c_job_t* job = &jobs[i];
+		i2c_transfer_t* transfer = job->transfer;
+		
+		if (transfer == NULL || --job->countdown != 0) {
+			continue;
+		}
+		
+		job->countdown = job->period;
+		
+		if (transfer->status == I2C_ERROR_BUSY) {
+			job->overruns++;
+			continue;
+		}
+		
+		transfer->read_segment.data = job->buffer + (job->front ^ 1) * job->number_of_bytes;
+		
+		_i2c_rewind(transfer);
+		
+		transfer->status = I2C_ERROR_BUSY;
+		
+#if I2C_STATS
+		transfer->submitted_at = I2C_STATS_TIMESTAMP();
+#endif
+		
+		_i2c_ready(_i2c_bus(transfer), (uint8_t)(transfer - pool));
+	}
 }
+#endif
 
-device_t* i2c_create_device(uint8_t address) {
-    
-    device_t* device = (device_t*)malloc(sizeof(device_t));
-    
-    if (device == NULL) {
-        return NULL;
-    }
-    
-    device->address = address; // First 7 bits describe the device address. Last bit := Read/Write
-    
-    return device;
+/*
+ * Frees a bus that a slave holds by keeping SDA low: clocks SCL until SDA is
+ * released (at most 9 times), then generates a STOP by hand. TWEN is off, so
+ * both lines are driven as open-drain GPIOs.
+ */
+static void _i2c_clear_bus(i2c_bus_t* bus) {
+	
+	uint8_t sda = I2C_BUS_SDA(I2C_INDEX(bus));
+	uint8_t scl = I2C_BUS_SCL(I2C_INDEX(bus));
+	
+	I2C_TWCR(I2C_INDEX(bus)) = 0;
+	
+	I2C_LINE_RELEASE(sda);
+	I2C_LINE_RELEASE(scl);
+	_delay_us(I2C_RECOVERY_HALF_PERIOD_US);
+	
+	for (uint8_t i = 0; i < 9 && !(I2C_BUS_PIN(I2C_INDEX(bus)) & (1 << sda)); i++) {
+		I2C_LINE_LOW(scl);
+		_delay_us(I2C_RECOVERY_HALF_PERIOD_US);
+		I2C_LINE_RELEASE(scl);
+		_delay_us(I2C_RECOVERY_HALF_PERIOD_US);
+	}
+	
+	// STOP: SDA rises while SCL is high
+	I2C_LINE_LOW(scl);
+	_delay_us(I2C_RECOVERY_HALF_PERIOD_US);
+	I2C_LINE_LOW(sda);
+	_delay_us(I2C_RECOVERY_HALF_PERIOD_US);
+	I2C_LINE_RELEASE(scl);
+	_delay_us(I2C_RECOVERY_HALF_PERIOD_US);
+	I2C_LINE_RELEASE(sda);
+	_delay_us(I2C_RECOVERY_HALF_PERIOD_US);
 }
 
-i2c_error_t i2c_free_device(device_t* device) {
-    
-    free(device);  
-    
-    device = NULL;   
-    
-    return I2C_NO_ERROR;
+/*
+ * Aborts the payload on the bus after the watchdog expired, recovers the bus and
+ * re-enables the TWI. Bit rate and queue are kept, queued payloads start again.
+ */
+static void _i2c_recover(i2c_bus_t* bus) {
+	
+	_isr_i2c_free_payload(bus, I2C_ERROR_TIMEOUT);
+	
+	_i2c_clear_bus(bus);
+	
+	I2C_TWCR_INIT();
+	
+	bus->chain_length = 0;
+	bus->watchdog_ticks = 0;
+	bus->waiting = 0;
+	bus->state = I2C_INACTIVE;
+	
+	_isr_i2c_kick(bus);
 }
 
-static void _isr_i2c_free_payload(void) {
+#if I2C_STATS
+void i2c_stats_snapshot(i2c_stats_t* snapshot) {
 	
-	if (payload != NULL) {
-		payload_free_i2c(payload);
-		payload = NULL;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*snapshot = stats;
+		snapshot->queue_depth = 0;
+		
+		for (uint8_t i = 0; i < I2C_BUSES; i++) {
+			snapshot->queue_depth += _i2c_queue_depth(&buses[i]);
+		}
 	}
 }
 
-static void _isr_i2c_no_ack_response(void) {
+void i2c_device_stats(device_t* device, i2c_device_stats_t* snapshot) {
 	
-	_isr_i2c_free_payload();
-	
-	if (!queue_empty(queue)) {
-		payload = queue_dequeue(queue);
-		I2C_TX_STOP_START();
-	} else {
-		I2C_STATE = I2C_INACTIVE;
-		I2C_TX_STOP();	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*snapshot = device->stats;
 	}
 }
 
-static void _isr_i2c_handle_tx_complete(void) {
+void i2c_stats_reset(void) {
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memset(&stats, 0, sizeof(stats));
+	}
+}
+#endif
 
-	if (payload->i2c.callback != NULL) {
-		payload->i2c.callback(NULL);
-		payload->i2c.callback = NULL;
+void i2c_tick(void) {
+	
+	i2c_bus_t* bus;
+	
+	ticks++;
+	
+	for (bus = buses; bus < &buses[I2C_BUSES]; bus++) {
+		
+		if (!bus->enabled) {
+			continue;
+		}
+		
+#if I2C_POLLED
+		// A polled transfer keeps its own watchdog
+		if (bus->polling) {
+			bus->watchdog_ticks = 0;
+		}
+#endif
+		
+		// Another master may hold the bus for a while, a START only gives up on a bus that stays stuck
+		if (bus->state == I2C_ACTIVE && bus->timeout != 0 && ++bus->watchdog_ticks >= (bus->waiting ? bus->wait_timeout : bus->timeout)) {
+			_i2c_recover(bus);
+		}
+		
+		if (bus->retry_head != I2C_POOL_END) {
+			_i2c_tick_retries(bus);
+		}
 	}
 	
-	_isr_i2c_free_payload();
+#if I2C_PERIODIC_JOBS
+	_i2c_tick_periodic();
+#endif
 	
-	if (!queue_empty(queue)) {
-		payload = queue_dequeue(queue);
-		I2C_TX_STOP_START();
-	} else {		
-		I2C_STATE = I2C_INACTIVE;
-		I2C_TX_STOP();	
+	for (bus = buses; bus < &buses[I2C_BUSES]; bus++) {
+		if (bus->enabled) {
+			_isr_i2c_kick(bus);
+		}
 	}
 }
 
-static void _isr_i2c_handle_rx_complete(void) {
-
-	_isr_i2c_free_payload();
+/*
+ * Another master won the bus. The payload is rewound and kept on the bus to
+ * go first once it is free again, or fails with I2C_ERROR_ARB_LOST when it
+ * streams or lost I2C_ARB_LOST_RETRIES times. Then the next payload is taken.
+ * The bus is not ours, so no STOP is sent.
+ */
+static void _isr_i2c_arb_lost(i2c_bus_t* bus) {
 	
-	if (!queue_empty(queue)) {
-		payload = queue_dequeue(queue);
-		I2C_RX_STOP_START();
-	} else {
-		I2C_STATE = I2C_INACTIVE;
-		I2C_RX_STOP();
+	i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+	
+	bus->chain_length = 0;
+	
+	// Stream chunks may already be refilled or drained
+	if (transfer->stream != NULL || transfer->arb_losses >= I2C_ARB_LOST_RETRIES) {
+		_isr_i2c_free_payload(bus, I2C_ERROR_ARB_LOST);
+		bus->payload = _isr_i2c_next(bus);
+		return;
 	}
+	
+	transfer->arb_losses++;
+	
+#if I2C_STATS
+	stats.arb_lost++;
+	transfer->payload.i2c.device->stats.arb_lost++;
+#endif
+	
+	_i2c_rewind(transfer);
 }
 
-static void _isr_i2c_callback(void) {
+#if I2C_SLAVE
+/* Lost arbitration to a master addressing us, the payload goes first after our STOP. */
+static void _isr_i2c_slave_arb_lost(i2c_bus_t* bus) {
 	
-	if (payload->i2c.callback != NULL) {
-		payload->i2c.callback(NULL);
-		payload->i2c.callback = NULL;
+	_isr_i2c_arb_lost(bus);
+	
+	if (bus->payload != NULL) {
+		_i2c_ready_front(bus, (uint8_t)((i2c_transfer_t*)bus->payload - pool));
+		bus->payload = NULL;
 	}
 }
+#endif
 
-ISR(TWI_vect) {
+/* Advances the bus by one TWSR status. Called by the TWI ISR of the bus, or by the thread for polled transfers. */
+static I2C_ISR_INLINE void _i2c_state_machine(i2c_bus_t* bus) {
 
     // Mask the prescaler bits to zero
-    switch(TWSR & 0xF8) {
+	uint8_t status = I2C_TWSR(I2C_INDEX(bus)) & 0xF8;
+	
+	bus->watchdog_ticks = 0;
+	bus->waiting = 0;
+	
+    switch(status) {
 		// Master Transmitter Mode
         case I2C_STATUS_START:
         case I2C_STATUS_REPEAT_START: {	
 			
-			if (payload->i2c.mode == WRITE) {
-				TWDR = ((payload->i2c.device->address << 1) | 0x00);			
+			// A START from the thread or a tick picks its payload here
+			if (bus->payload == NULL && (bus->payload = _isr_i2c_next(bus)) == NULL) {
+				bus->state = I2C_INACTIVE;
+				I2C_TX_STOP();
+				break;
+			}
+			
+			if (bus->payload->i2c.mode == WRITE) {
+				I2C_TWDR(I2C_INDEX(bus)) = ((((i2c_transfer_t*)bus->payload)->address << 1) | 0x00);			
 			} else {			
-				TWDR = ((payload->i2c.device->address << 1) | 0x01);
+				I2C_TWDR(I2C_INDEX(bus)) = ((((i2c_transfer_t*)bus->payload)->address << 1) | 0x01);
 			}
             
             I2C_TX_TRANSMIT();
@@ -282,7 +2186,7 @@ ISR(TWI_vect) {
           
         case I2C_STATUS_TX_ADDR_ACK: {  
 				
-            TWDR = *(payload->i2c.data);	
+            I2C_TWDR(I2C_INDEX(bus)) = _isr_i2c_tx_byte(bus);	
 				
             I2C_TX_TRANSMIT();
 			
@@ -291,24 +2195,34 @@ ISR(TWI_vect) {
              
         case I2C_STATUS_TX_ADDR_NACK: {   
 			    		
-			_isr_i2c_no_ack_response();	
+			_isr_i2c_no_ack_response(bus, I2C_ERROR_ADDR_NACK);	
 			
             break;
         }
             
         case I2C_STATUS_TX_DATA_ACK: {
+			
+			i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
 
-            payload->i2c.number_of_bytes--;
+			transfer->transferred++;
+			
+            transfer->remaining--;
 			
-            (payload->i2c.data)++;
+            transfer->cursor++;
+			
+			if (transfer->remaining == 0 && transfer->number_of_segments == 0 && transfer->stream != NULL) {
+				_isr_i2c_refill(transfer);
+			}
             
-            if (payload->i2c.number_of_bytes != 0) {	
+            if (transfer->remaining != 0) {	
 						
-                TWDR = *(payload->i2c.data);	
+                I2C_TWDR(I2C_INDEX(bus)) = _isr_i2c_tx_byte(bus);	
 							
                 I2C_TX_TRANSMIT();      	    
-            } else {			
-				_isr_i2c_handle_tx_complete();
+            } else if (transfer->number_of_segments != 0) {
+				_isr_i2c_next_segment(bus);
+			} else {			
+				_isr_i2c_handle_tx_complete(bus);
 			}
 					
             break;
@@ -316,35 +2230,71 @@ ISR(TWI_vect) {
 
         case I2C_STATUS_TX_DATA_NACK: { 
 				   		
-			_isr_i2c_no_ack_response();
+			_isr_i2c_no_ack_response(bus, I2C_ERROR_DATA_NACK);
 			
             break;
         }
+		
+		// Master Transmitter and Receiver Mode
+		case I2C_STATUS_ARB_LOST: {
+			
+			_isr_i2c_arb_lost(bus);
+			
+			// The TWI holds the START until the other master sends its STOP
+			if (bus->payload != NULL) {
+				I2C_TX_START();
+			} else {
+				bus->state = I2C_INACTIVE;
+				I2C_TX_RELEASE();
+			}
+			
+			break;
+		}
                      
 		// Master Receiver Mode   
 		case I2C_STATUS_RX_ADDR_ACK: {
 			
-			I2C_RX_SEND_ACK();
+			// NACK the last byte so the slave releases SDA before STOP
+			if (_isr_i2c_rx_continues(bus)) {
+				I2C_RX_SEND_ACK();
+			} else {
+				I2C_RX_SEND_NACK();
+			}
 			
 			break;
 		} 
 		
 		case I2C_STATUS_RX_ADDR_NACK: {
 			
-			_isr_i2c_no_ack_response();
+			_isr_i2c_no_ack_response(bus, I2C_ERROR_ADDR_NACK);
 			
 			break;
 		}
 		
 		case I2C_STATUS_RX_DATA_ACK: {	
 			
-			payload->i2c.number_of_bytes--;
+			i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+			
+			*(transfer->cursor) = I2C_TWDR(I2C_INDEX(bus));
+			
+			transfer->transferred++;
+			
+			transfer->remaining--;
 			
-			(payload->i2c.data)++;
+			transfer->cursor++;
 			
-			_isr_i2c_callback();
+			_isr_i2c_rx_watermark(transfer);
 			
-			if (payload->i2c.number_of_bytes != 0) {
+			// Continue into the next stream chunk or a read segment that has no repeated START
+			if (transfer->remaining == 0) {
+				if (transfer->number_of_segments == 0) {
+					_isr_i2c_refill(transfer);
+				} else {
+					_i2c_load_segment(transfer);
+				}
+			}
+			
+			if (_isr_i2c_rx_continues(bus)) {
 				I2C_RX_SEND_ACK();
 			} else {
 				I2C_RX_SEND_NACK();
@@ -355,21 +2305,213 @@ ISR(TWI_vect) {
 		
 		case I2C_STATUS_RX_DATA_NACK: {
 			
-			_isr_i2c_callback();
-			_isr_i2c_handle_rx_complete();
+			i2c_transfer_t* transfer = (i2c_transfer_t*)bus->payload;
+			
+			*(transfer->cursor) = I2C_TWDR(I2C_INDEX(bus));
+			
+			transfer->transferred++;
+			
+			transfer->remaining--;
+			
+			if (transfer->number_of_segments != 0) {
+				_isr_i2c_next_segment(bus);
+			} else {
+				if (transfer->stream != NULL) {
+					_isr_i2c_refill(transfer);
+				}
+				
+				_isr_i2c_handle_rx_complete(bus);
+			}
 
 			break;
 		}
 		
+#if I2C_SLAVE
+		// Slave Receiver Mode
+		case I2C_STATUS_SR_ARB_LOST:
+			_isr_i2c_slave_arb_lost(bus);
+			// fall through
+		case I2C_STATUS_SR_ADDR_ACK: {
+			
+			bus->state = I2C_ADDRESSED;
+			bus->slave.select = 1;
+			
+			I2C_SLAVE_ACK();
+			
+			break;
+		}
+		
+		case I2C_STATUS_SR_DATA_ACK: {
+			
+			_isr_i2c_slave_receive(bus, I2C_TWDR(I2C_INDEX(bus)));
+			
+			I2C_SLAVE_ACK();
+			
+			break;
+		}
+		
+		// Slave Transmitter Mode
+		case I2C_STATUS_ST_ARB_LOST:
+			_isr_i2c_slave_arb_lost(bus);
+			// fall through
+		case I2C_STATUS_ST_ADDR_ACK: {
+			
+			bus->state = I2C_ADDRESSED;
+			
+			I2C_TWDR(I2C_INDEX(bus)) = _isr_i2c_slave_transmit(bus);
+			
+			I2C_SLAVE_ACK();
+			
+			break;
+		}
+		
+		case I2C_STATUS_ST_DATA_ACK: {
+			
+			I2C_TWDR(I2C_INDEX(bus)) = _isr_i2c_slave_transmit(bus);
+			
+			I2C_SLAVE_ACK();
+			
+			break;
+		}
+		
+		// A read that the master ended leaves the pointer after the last byte sent
+		case I2C_STATUS_SR_DATA_NACK:
+		case I2C_STATUS_SR_STOP:
+		case I2C_STATUS_ST_DATA_NACK:
+		case I2C_STATUS_ST_LAST_DATA: {
+			
+			_isr_i2c_slave_release(bus);
+			
+			break;
+		}
+#endif
+		
 		default: {
 			
-			_isr_i2c_free_payload();
+			_isr_i2c_free_payload(bus, I2C_ERROR_BUS);
 			
-			I2C_STATE = I2C_INACTIVE;
+			bus->state = I2C_INACTIVE;
 			
 			I2C_TX_STOP();
 			
 			break;
 		}
     }
-}
\ No newline at end of file
+}
+
+ISR(I2C_TWI0_vect) {
+	
+	_i2c_state_machine(&buses[0]);
+}
+
+#if I2C_BUSES > 1
+ISR(I2C_TWI1_vect) {
+	
+	_i2c_state_machine(&buses[1]);
+}
+#endif
+
+#if I2C_POLLED
+/*
+ * Runs the transfer with the TWI interrupt off, spinning on TWINT. Only taken
+ * while the bus is idle, nothing is queued and no register map is attached,
+ * otherwise the transfer is queued and waited for. Delayed retries continue
+ * asynchronously.
+ */
+static i2c_error_t _i2c_submit_polled(i2c_transfer_t* transfer) {
+	
+	i2c_bus_t* bus = _i2c_bus(transfer);
+	uint16_t progress;
+	
+	if (_i2c_empty(transfer)) {
+		_i2c_finish(transfer, I2C_ERROR_INVALID_PAYLOAD);
+		return I2C_ERROR_INVALID_PAYLOAD;
+	}
+	
+	_i2c_prepare(transfer);
+	
+	transfer->status = I2C_ERROR_BUSY;
+	transfer->flags |= I2C_TRANSFER_TRACKED;
+	
+	bus->kicking = 1;
+	
+	if (bus->state != I2C_INACTIVE || _i2c_pending(bus) || I2C_TWEA) {
+		bus->kicking = 0;
+		
+		if (_i2c_enqueue(bus, transfer)) {
+			_i2c_finish(transfer, I2C_ERROR_QUEUE_FULL);
+			return i2c_poll(transfer);
+		}
+		
+		_i2c(bus);
+		
+		return i2c_wait(transfer);
+	}
+	
+	bus->state = I2C_ACTIVE;
+	bus->polling = 1;
+	bus->twie = 0;
+	bus->payload = &transfer->payload;
+	progress = _i2c_ticks();
+	
+	_i2c_set_speed(bus, transfer->payload.i2c.device);
+	
+	I2C_TX_START();
+	
+	while (bus->state == I2C_ACTIVE) {
+		
+		if (I2C_TWCR(I2C_INDEX(bus)) & (1 << TWINT)) {
+			// Completions and statistics are shared with the ISRs of the other buses
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				_i2c_state_machine(bus);
+			}
+			progress = _i2c_ticks();
+		} else if (bus->timeout != 0 && (uint16_t)(_i2c_ticks() - progress) >= (bus->waiting ? bus->wait_timeout : bus->timeout)) {
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				_i2c_recover(bus);
+			}
+		}
+	}
+	
+	bus->twie = (1 << TWIE);
+	bus->polling = 0;
+	bus->kicking = 0;
+	
+	if (_i2c_pending(bus)) {
+		_i2c(bus);
+	}
+	
+	return i2c_wait(transfer);
+}
+
+i2c_error_t i2c_write_polled(payload_t* _payload) {
+	
+	i2c_transfer_t* transfer = _i2c_adopt_payload(_payload);
+	
+	if (transfer == NULL) {
+		return I2C_ERROR_POOL_EMPTY;
+	}
+	
+	transfer->payload.i2c.mode = WRITE;
+	
+	_i2c_load_payload(transfer);
+	
+	return _i2c_submit_polled(transfer);
+}
+
+i2c_error_t i2c_write_read_polled(payload_t* _payload, uint8_t* rx_data, uint16_t rx_bytes) {
+	
+	i2c_transfer_t* transfer = _i2c_adopt_payload(_payload);
+	
+	if (transfer == NULL) {
+		return I2C_ERROR_POOL_EMPTY;
+	}
+	
+	transfer->payload.i2c.mode = WRITE;
+	
+	_i2c_load_payload(transfer);
+	_i2c_set_read_phase(transfer, rx_data, rx_bytes);
+	
+	return _i2c_submit_polled(transfer);
+}
+#endif
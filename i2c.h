@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <avr/pgmspace.h>
 
 /* User defined libraries */
 #include "i2c_io.h"
@@ -42,21 +43,278 @@
 #include "i2c_error_handler.h"
 #include "ringbuffer.h"
 
+#if I2C_STATS
+/* Per-device counters, see i2c_device_stats() */
+typedef struct i2c_device_stats_t {
+    uint16_t completed;
+    uint16_t nacks;        // Address and data NACKs
+    uint16_t arb_lost;     // Every lost arbitration, resumed ones included
+    uint16_t errors;       // Bus errors, timeouts, queue full
+    uint16_t max_latency;  // Submission to completion, I2C_STATS_TIMESTAMP() units
+} i2c_device_stats_t;
+
+/* Global counters, see i2c_stats_snapshot() */
+typedef struct i2c_stats_t {
+    uint32_t completed;
+    uint32_t bytes;
+    uint16_t addr_nacks;
+    uint16_t data_nacks;
+    uint16_t arb_lost;
+    uint16_t bus_errors;
+    uint16_t timeouts;
+    uint16_t queue_full;
+    uint16_t retries;
+    uint8_t queue_depth;      // Submissions waiting in the ring
+    uint8_t max_queue_depth;
+    uint16_t latency[I2C_STATS_LATENCY_BUCKETS]; // Bucket n: latency below 2^n, last bucket: all above
+} i2c_stats_t;
+#endif
+
 /* Describes a i2c device */
 typedef struct device_t {
     uint8_t address;
+    uint8_t bus;           // TWI controller the device is attached to
+    uint8_t twbr;          // Bit rate, see i2c_device_set_speed()
+    uint8_t twps;          // 0: bus speed from i2c_init()
+#if I2C_STATS
+    i2c_device_stats_t stats;
+#endif
 } device_t;
 
+/* Segment flags */
+#define I2C_SEGMENT_WRITE       0x00
+#define I2C_SEGMENT_READ        0x01
+#define I2C_SEGMENT_NO_RESTART  0x02 // Continue the previous segment in the same direction without a repeated START
+#define I2C_SEGMENT_FLASH       0x04 // Write segment data in PROGMEM (lower 64 KB)
+
+/* Describes one segment of a scatter/gather transfer. The buffer is used in place and must not be empty. */
+typedef struct i2c_segment_t {
+    uint8_t* data;
+    uint16_t number_of_bytes;
+    uint8_t flags;
+} i2c_segment_t;
+
+/* Retry flags */
+#define I2C_RETRY_FIXED        0x00
+#define I2C_RETRY_EXPONENTIAL  0x01 // Double the delay after every attempt
+#define I2C_RETRY_ACK_POLLING  0x02 // Retry address NACKs only, without delay (EEPROM write cycle)
+
+/*
+ * Stream hook, see i2c_payload_set_stream(). Called from the ISR each time a chunk
+ * was sent or filled. Point *chunk at the next one and return its length.
+ */
+typedef uint16_t (*i2c_stream_fn)(payload_t* payload, uint8_t** chunk);
+
+/*
+ * Completion callback, see i2c_payload_set_callback(). Receives the context given
+ * there and the result, I2C_ERROR_BUSY for a watermark progress notification.
+ */
+typedef void (*i2c_callback_t)(void* context, i2c_error_t result);
+
+#if I2C_SLAVE
+/* Called from the ISR at the end of a write that stored count bytes from register reg on */
+typedef void (*i2c_slave_fn)(uint8_t reg, uint16_t count);
+
+/*
+ * Register map served in slave mode, directly from the ISR. The first byte of a
+ * write selects the register, the following bytes are stored from there. Reads
+ * continue from the register pointer, which auto-increments up to size without
+ * wrapping, so registers past 255 are reached by auto-increment only. Bits set
+ * in write_mask[reg] may be written by the master (NULL: all), reads beyond the
+ * map return 0xFF. The arrays are used in place.
+ */
+typedef struct i2c_register_map_t {
+    uint8_t address;
+    uint8_t* regs;
+    const uint8_t* write_mask;
+    uint16_t size;
+    i2c_slave_fn callback;
+} i2c_register_map_t;
+#endif
+
+/* Handle to a submitted transfer, see i2c_track() */
+typedef struct i2c_transfer_t* i2c_handle_t;
+
+/* Initializes the TWI controller config->bus. Call once per bus, the payload pool is shared. */
 i2c_error_t i2c_init(i2c_config_t* config);
 
+/* Payload data must not be empty, I2C_ERROR_INVALID_PAYLOAD otherwise. */
 i2c_error_t i2c_read(payload_t*);
 
 i2c_error_t i2c_write(payload_t*);
 
+/* Writes the payload data (e.g. a register address), then reads rx_bytes after a repeated START. */
+i2c_error_t i2c_write_read(payload_t* payload, uint8_t* rx_data, uint16_t rx_bytes);
+
+/* Runs the segments as one transaction to the payload's device. Payload data is ignored, segments must stay valid until completion. */
+i2c_error_t i2c_transfer(payload_t* payload, i2c_segment_t* segments, uint8_t number_of_segments);
+
+#if I2C_POLLED
+/*
+ * Blocking variants that spin on TWINT instead of taking the TWI interrupt, for
+ * short transfers such as init sequences. Fall back to the queue when the bus
+ * is busy. Return the result, the payload is consumed and must not be tracked.
+ */
+i2c_error_t i2c_write_polled(payload_t* payload);
+
+i2c_error_t i2c_write_read_polled(payload_t* payload, uint8_t* rx_data, uint16_t rx_bytes);
+#endif
+
 device_t* i2c_create_device(uint8_t address);
 
+/*
+ * Device on another TWI controller (see I2C_BUSES), NULL if the bus does not exist.
+ * Its payloads go through the queue of that bus.
+ */
+device_t* i2c_create_bus_device(uint8_t bus, uint8_t address);
+
+/*
+ * Runs the device at its own SCL frequency (0: back to the bus speed), e.g. fast
+ * sensors next to a standard mode part. The bit rate is switched before each of
+ * its transfers. Set while none is queued, after i2c_init().
+ * Only speeds up: the bus speed must be that of the slowest device, as a START
+ * on an idle bus is sent before its payload is picked. Slower rates, and any
+ * rate before i2c_init(), are refused with I2C_ERROR_INVALID_SPEED.
+ */
+i2c_error_t i2c_device_set_speed(device_t* device, uint32_t scl_frequency);
+
+/*
+ * SCL frequency in Hz that bus runs at, 0 before i2c_init(). Rates are rounded
+ * down, targets out of reach get the nearest one. error (may be NULL) receives
+ * the deviation from the target in 0.1 %, negative when slower.
+ */
+uint32_t i2c_bus_frequency(uint8_t bus, int16_t* error);
+
+/* SCL frequency in Hz of the device, its own (i2c_device_set_speed()) or the bus speed */
+uint32_t i2c_device_frequency(device_t* device);
+
 i2c_error_t i2c_free_device(device_t* device);
 
 extern payload_t* payload_create_i2c(priority_t priority, device_t* device, uint8_t* data, uint8_t number_of_bytes, callback_fn callback);
 
+/* Payloads taken from the static pool (see I2C_PAYLOAD_POOL_SIZE). Safe to call from thread and ISR context. */
+payload_t* i2c_payload_create(priority_t priority, device_t* device, uint8_t* data, uint16_t number_of_bytes, callback_fn callback);
+
+/*
+ * Register table records for i2c_payload_create_table(), to be placed in PROGMEM.
+ * length counts the data bytes (register included), delay is in ticks and
+ * applies before the next record. A table ends with I2C_TABLE_END.
+ */
+#define I2C_TABLE_WRITE(address, delay, length, ...) (address), (length), __VA_ARGS__, (delay)
+#define I2C_TABLE_REG(address, reg, value)          I2C_TABLE_WRITE(address, 0, 2, reg, value)
+#define I2C_TABLE_END                               0xFF
+
+/*
+ * One payload that writes every record of a flash table, each to its own address,
+ * joined by repeated STARTs. Submit with i2c_write(). A retry repeats the failed record.
+ * The table runs on the bus and at the speed of device and counts into its
+ * statistics, device->address is not used. NULL for an empty table or a record
+ * without data.
+ */
+payload_t* i2c_payload_create_table(priority_t priority, device_t* device, const uint8_t* table, callback_fn callback);
+
+/* Payloads transmitting constant data straight from flash, without a RAM copy. Write only. */
+payload_t* i2c_payload_create_P(priority_t priority, device_t* device, const uint8_t* data, uint16_t number_of_bytes, callback_fn callback);
+
+#if I2C_FAR_FLASH
+/* Flash beyond 64 KB, e.g. data = pgm_get_far_address(bitmap) */
+payload_t* i2c_payload_create_far(priority_t priority, device_t* device, uint_farptr_t data, uint16_t number_of_bytes, callback_fn callback);
+#endif
+
+i2c_error_t i2c_payload_free(payload_t* payload);
+
+uint8_t i2c_payload_high_water_mark(void);
+
+/*
+ * Submission consumes the payload, also when an error is returned. The completion
+ * callback receives the payload, where the result and the number of data bytes
+ * actually transferred can be read. Pool payloads only.
+ */
+i2c_error_t i2c_payload_result(payload_t* payload);
+
+uint32_t i2c_payload_transferred(payload_t* payload);
+
+/*
+ * Completion tracking. Call i2c_track() on a pool payload before submitting it.
+ * i2c_poll() returns I2C_ERROR_BUSY while the transfer is pending. Once any of
+ * the functions below reports the final result, the handle is released.
+ * i2c_wait() sleeps in idle mode and needs global interrupts enabled.
+ */
+i2c_handle_t i2c_track(payload_t* payload);
+
+i2c_error_t i2c_poll(i2c_handle_t handle);
+
+i2c_error_t i2c_wait(i2c_handle_t handle);
+
+/* Timeout in ticks, see i2c_tick(). Returns I2C_ERROR_TIMEOUT and keeps the handle valid on expiry. */
+i2c_error_t i2c_wait_timeout(i2c_handle_t handle, uint16_t timeout);
+
+/*
+ * Retries NACKed transfers up to max_retries times, delay in ticks. Set before submission.
+ * Lost arbitrations are resumed without delay by the driver, see I2C_ARB_LOST_RETRIES.
+ */
+i2c_error_t i2c_payload_set_retry(payload_t* payload, uint8_t max_retries, uint16_t delay, uint8_t flags);
+
+/*
+ * Adds a completion callback with context, called after the payload callback.
+ * Set before submission.
+ */
+i2c_error_t i2c_payload_set_callback(payload_t* payload, i2c_callback_t callback, void* context);
+
+/*
+ * Deferred mode (i2c_config_t.deferred): the ISR only queues completed transfers,
+ * their callbacks run here, in thread context. Call from the main loop. Watermark
+ * notifications are not deferred. Returns the number of completions processed.
+ */
+uint8_t i2c_process_completions(void);
+
+/*
+ * Calls the payload callback every watermark received bytes, before completion.
+ * i2c_payload_transferred() tells how far the data is valid. Set before submission.
+ */
+i2c_error_t i2c_payload_set_watermark(payload_t* payload, uint16_t watermark);
+
+/*
+ * Streams the last segment (payload data, read phase or last i2c_transfer() segment)
+ * as length bytes in chunks, the segment itself being the first chunk. A write
+ * ends early when the hook returns 0, a read must be supplied up to length.
+ * Streams are not retried. Set before submission.
+ */
+i2c_error_t i2c_payload_set_stream(payload_t* payload, i2c_stream_fn stream, uint32_t length);
+
+#if I2C_STATS
+/* Consistent copies of the counters, safe to call while transfers are running */
+void i2c_stats_snapshot(i2c_stats_t* snapshot);
+
+void i2c_device_stats(device_t* device, i2c_device_stats_t* snapshot);
+
+void i2c_stats_reset(void);
+#endif
+
+#if I2C_PERIODIC_JOBS
+/* Handle to a periodic job, see i2c_periodic_create() */
+typedef struct i2c_job_t* i2c_periodic_t;
+
+/*
+ * Reads number_of_bytes from register reg every period ticks, re-armed by i2c_tick()
+ * without allocation. buffer holds two samples (2 * number_of_bytes), one is
+ * filled by the bus while the other keeps the latest result. Each job takes a
+ * pool payload until stopped. The callback receives the payload after every
+ * sample, i2c_periodic_read() already returns that sample.
+ */
+i2c_periodic_t i2c_periodic_create(device_t* device, uint8_t reg, uint8_t* buffer, uint8_t number_of_bytes, uint16_t period, callback_fn callback);
+
+/* Copies the latest good sample. Returns the result of the last sample, I2C_ERROR_BUSY before the first one. */
+i2c_error_t i2c_periodic_read(i2c_periodic_t job, uint8_t* data);
+
+/* Periods skipped because the previous sample was still pending */
+uint16_t i2c_periodic_overruns(i2c_periodic_t job);
+
+/* The buffer stays in use until a sample already on its way completes. */
+i2c_error_t i2c_periodic_stop(i2c_periodic_t job);
+#endif
+
+/* Driver time base. Call periodically from a timer ISR, the period is the unit of all driver timeouts. */
+void i2c_tick(void);
+
 #endif /* I2C_H_ */
\ No newline at end of file
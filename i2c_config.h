@@ -38,18 +38,151 @@
 #define I2C_HIGH_SPEED   3400000  // 3.4 MHz (not supported on all ATmega)
 
 #define I2C_MASTER_MODE  1
-#define I2C_SLAVE_MODE   0 // Not implemented yet.
+#define I2C_SLAVE_MODE   2 // Register map target (i2c_config_t.slave), combine with I2C_MASTER_MODE
+
+// Number of payloads in the static pool used by i2c_payload_create()
+#ifndef I2C_PAYLOAD_POOL_SIZE
+#define I2C_PAYLOAD_POOL_SIZE 8
+#endif
+
+#if I2C_PAYLOAD_POOL_SIZE < 1 || I2C_PAYLOAD_POOL_SIZE > 254
+#error "I2C_PAYLOAD_POOL_SIZE must be in the range 1..254"
+#endif
+
+// Submission ring capacity, a power of two. Never full when >= I2C_PAYLOAD_POOL_SIZE.
+#ifndef I2C_QUEUE_SIZE
+#define I2C_QUEUE_SIZE 8
+#endif
+
+#if I2C_QUEUE_SIZE < 1 || I2C_QUEUE_SIZE > 128 || (I2C_QUEUE_SIZE & (I2C_QUEUE_SIZE - 1)) != 0
+#error "I2C_QUEUE_SIZE must be a power of two in the range 1..128"
+#endif
+
+// Priority levels with their own ring, priority_t values above the last level share it
+#ifndef I2C_PRIORITY_LEVELS
+#define I2C_PRIORITY_LEVELS 3
+#endif
+
+#if I2C_PRIORITY_LEVELS < 1 || I2C_PRIORITY_LEVELS > 8
+#error "I2C_PRIORITY_LEVELS must be in the range 1..8"
+#endif
+
+// TWI controllers driven, each with its own queue (see i2c_config_t.bus)
+#ifndef I2C_BUSES
+#define I2C_BUSES 1
+#endif
+
+#if I2C_BUSES < 1 || I2C_BUSES > I2C_BUSES_MAX
+#error "I2C_BUSES exceeds the TWI controllers of this MCU"
+#endif
+
+/*
+ * SCL frequency resolved from F_CPU at compile time, e.g. -DI2C_SCL_FREQUENCY=400000.
+ * Replaces i2c_config_t.scl_target_frequency and the startup divisions. The build
+ * fails when the achieved rate is more than I2C_SCL_TOLERANCE percent below it.
+ */
+#ifndef I2C_SCL_TOLERANCE
+#define I2C_SCL_TOLERANCE 5
+#endif
+
+#if defined(I2C_SCL_FREQUENCY)
+#if !defined(F_CPU)
+#error "I2C_SCL_FREQUENCY needs F_CPU"
+#endif
+
+// TWBR for prescaler value p, rounded up so SCL never exceeds the target
+#define I2C_SCL_TWBR_FOR(p) \
+	((F_CPU - 16UL * (I2C_SCL_FREQUENCY) + 2UL * (p) * (I2C_SCL_FREQUENCY) - 1) / (2UL * (p) * (I2C_SCL_FREQUENCY)))
+#define I2C_SCL_TWPS \
+	(I2C_SCL_TWBR_FOR(1) <= 255 ? 0 : I2C_SCL_TWBR_FOR(4) <= 255 ? 1 : I2C_SCL_TWBR_FOR(16) <= 255 ? 2 : 3)
+#define I2C_SCL_TWBR     I2C_SCL_TWBR_FOR(1UL << (2 * I2C_SCL_TWPS))
+#define I2C_SCL_ACHIEVED (F_CPU / (16UL + 2UL * I2C_SCL_TWBR * (1UL << (2 * I2C_SCL_TWPS))))
+
+#if F_CPU < 16UL * (I2C_SCL_FREQUENCY)
+#error "I2C_SCL_FREQUENCY is above F_CPU / 16"
+#elif I2C_SCL_TWBR > 255
+#error "I2C_SCL_FREQUENCY is below the slowest bit rate"
+#elif ((I2C_SCL_FREQUENCY) - I2C_SCL_ACHIEVED) * 100 > I2C_SCL_TOLERANCE * (I2C_SCL_FREQUENCY)
+#error "I2C_SCL_FREQUENCY is not reachable within I2C_SCL_TOLERANCE"
+#endif
+#endif
+
+// Schedulers, see i2c_config_t.scheduler
+#define I2C_SCHED_FIFO   0 // Submission order, priority ignored
+#define I2C_SCHED_STRICT 1 // Highest level first, lower levels promoted after .aging picks
+#define I2C_SCHED_WRR    2 // Weighted round-robin, level n gets 2^n picks per round
+
+// Slots in the periodic job table (i2c_periodic_create()), compiled out when 0
+#ifndef I2C_PERIODIC_JOBS
+#define I2C_PERIODIC_JOBS 4
+#endif
+
+// Polled transfers (i2c_write_polled()), compiled out when 0
+#ifndef I2C_POLLED
+#define I2C_POLLED 1
+#endif
+
+// Lost arbitrations a transfer is resumed after before it fails with I2C_ERROR_ARB_LOST
+#ifndef I2C_ARB_LOST_RETRIES
+#define I2C_ARB_LOST_RETRIES 8
+#endif
+
+// A START waiting for another master's STOP gets this many times the timeout before the bus is recovered
+#ifndef I2C_BUS_WAIT_FACTOR
+#define I2C_BUS_WAIT_FACTOR 10
+#endif
+
+// Slave mode (I2C_SLAVE_MODE), compiled out when 0
+#ifndef I2C_SLAVE
+#define I2C_SLAVE 1
+#endif
+
+// Far flash payloads (i2c_payload_create_far()), on devices with more than 64 KB flash
+#ifndef I2C_FAR_FLASH
+#if defined(__AVR_HAVE_ELPM__)
+#define I2C_FAR_FLASH 1
+#else
+#define I2C_FAR_FLASH 0
+#endif
+#endif
+
+// Runtime statistics (i2c_stats_snapshot()), compiled out when 0
+#ifndef I2C_STATS
+#define I2C_STATS 0
+#endif
+
+// Number of latency histogram buckets
+#ifndef I2C_STATS_LATENCY_BUCKETS
+#define I2C_STATS_LATENCY_BUCKETS 8
+#endif
+
+// Latency time base, defaults to the i2c_tick() counter. Define as a free-running
+// timer for finer resolution, e.g. #define I2C_STATS_TIMESTAMP() TCNT1
 
 #define I2C_DEFAULT_CONFIG { \
 	.scl_target_frequency = I2C_STANDARD_MODE, \
 	.internal_pullups = 1, \
 	.mode = I2C_MASTER_MODE, \
+	.chain_limit = 0, \
+	.timeout = 0, \
+	.scheduler = I2C_SCHED_FIFO, \
+	.aging = 0, \
+	.deferred = 0, \
+	.slave = NULL, \
+	.bus = 0, \
 }
 
 typedef struct {
-	uint32_t scl_target_frequency; // Target I2C frequency (e.g., 100000 for 100 kHz)
+	uint32_t scl_target_frequency; // Target I2C frequency (e.g., 100000 for 100 kHz), ignored with I2C_SCL_FREQUENCY
 	uint8_t internal_pullups;         // Enable/Disable internal pull-ups
 	uint8_t mode;                  // Master or Slave mode
+	uint8_t chain_limit;           // Queued payloads chained by repeated START before a STOP (0 = off)
+	uint16_t timeout;              // Ticks without bus progress before the bus is recovered (0 = off), I2C_BUS_WAIT_FACTOR times that while a START waits for the bus
+	uint8_t scheduler;             // I2C_SCHED_FIFO, I2C_SCHED_STRICT or I2C_SCHED_WRR
+	uint8_t aging;                 // Strict: times a waiting level may be passed over (0 = never promoted)
+	uint8_t deferred;              // Callbacks run from i2c_process_completions() instead of the ISR
+	const struct i2c_register_map_t* slave; // Register map answered in I2C_SLAVE_MODE, see i2c.h
+	uint8_t bus;                   // TWI controller to initialize, 0..I2C_BUSES-1
 } i2c_config_t;
 
 #endif /* I2C_CONFIG_H_ */
\ No newline at end of file
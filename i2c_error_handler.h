@@ -43,6 +43,16 @@
 typedef enum i2c_error_t {
     I2C_NO_ERROR,
 	I2C_ERROR_NULL_CONFIG,
+	I2C_ERROR_POOL_EMPTY,
+	I2C_ERROR_INVALID_PAYLOAD,
+	I2C_ERROR_QUEUE_FULL,
+	I2C_ERROR_BUSY,       // Transfer still pending
+	I2C_ERROR_ADDR_NACK,  // SLA+W/SLA+R not acknowledged
+	I2C_ERROR_DATA_NACK,  // Data byte not acknowledged
+	I2C_ERROR_ARB_LOST,
+	I2C_ERROR_BUS,        // Illegal START/STOP or unexpected TWI status
+	I2C_ERROR_TIMEOUT,
+	I2C_ERROR_INVALID_SPEED, // SCL frequency below the bus speed, or bus not initialised
 } i2c_error_t;
 
 /**
@@ -51,13 +51,64 @@ Extend this file according to the datasheet of your MCU.
 
 /* I2C Port Declaration */
 #if defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega16__)
+#   define I2C_PORT PORTC
+#   define I2C_DDR  DDRC
+#   define I2C_PIN  PINC
+#   define SDA PC1
+#   define SCL PC0
 #elif defined(__AVR_ATmega2560__)
+#   define I2C_PORT PORTD
+#   define I2C_DDR  DDRD
+#   define I2C_PIN  PIND
 #   define SDA PD1
 #   define SCL PD0
+#elif defined(__AVR_ATmega328PB__)
+#   define I2C_PORT PORTC
+#   define I2C_DDR  DDRC
+#   define I2C_PIN  PINC
+#   define SDA PC4
+#   define SCL PC5
+/* Second TWI */
+#   define I2C1_PORT PORTE
+#   define I2C1_DDR  DDRE
+#   define I2C1_PIN  PINE
+#   define SDA1 PE0
+#   define SCL1 PE1
 #else
 #  if !defined(__COMPILING_AVR_LIBC__)
 #    warning "I2C PORTS NOT DEFINED"
 #  endif
 #endif
 
+/* Registers, pins and interrupt of bus n, see I2C_BUSES. Bus 0 only unless I2C_BUSES > 1. */
+#if defined(I2C1_PORT)
+#   define I2C_BUSES_MAX 2
+#   define I2C_SELECT(n, bus0, bus1) (*((I2C_BUSES > 1 && (n)) ? &(bus1) : &(bus0)))
+#   define I2C_TWCR(n)      I2C_SELECT(n, TWCR0, TWCR1)
+#   define I2C_TWDR(n)      I2C_SELECT(n, TWDR0, TWDR1)
+#   define I2C_TWSR(n)      I2C_SELECT(n, TWSR0, TWSR1)
+#   define I2C_TWBR(n)      I2C_SELECT(n, TWBR0, TWBR1)
+#   define I2C_TWAR(n)      I2C_SELECT(n, TWAR0, TWAR1)
+#   define I2C_BUS_PORT(n)  I2C_SELECT(n, I2C_PORT, I2C1_PORT)
+#   define I2C_BUS_DDR(n)   I2C_SELECT(n, I2C_DDR, I2C1_DDR)
+#   define I2C_BUS_PIN(n)   I2C_SELECT(n, I2C_PIN, I2C1_PIN)
+#   define I2C_BUS_SDA(n)   ((I2C_BUSES > 1 && (n)) ? SDA1 : SDA)
+#   define I2C_BUS_SCL(n)   ((I2C_BUSES > 1 && (n)) ? SCL1 : SCL)
+#   define I2C_TWI0_vect    TWI0_vect
+#   define I2C_TWI1_vect    TWI1_vect
+#else
+#   define I2C_BUSES_MAX 1
+#   define I2C_TWCR(n)      TWCR
+#   define I2C_TWDR(n)      TWDR
+#   define I2C_TWSR(n)      TWSR
+#   define I2C_TWBR(n)      TWBR
+#   define I2C_TWAR(n)      TWAR
+#   define I2C_BUS_PORT(n)  I2C_PORT
+#   define I2C_BUS_DDR(n)   I2C_DDR
+#   define I2C_BUS_PIN(n)   I2C_PIN
+#   define I2C_BUS_SDA(n)   SDA
+#   define I2C_BUS_SCL(n)   SCL
+#   define I2C_TWI0_vect    TWI_vect
+#endif
+
 #endif /* I2C_IO_H_ */
\ No newline at end of file
@@ -0,0 +1,206 @@
+/*************************************************************************
+* Title		: bench_check.c
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: -
+* License	: MIT License
+* Usage		: see Doxygen manual
+*
+*       Copyright (C) 2026 Dimitri Dening
+*
+*       Permission is hereby granted, free of charge, to any person obtaining a copy
+*       of this software and associated documentation files (the "Software"), to deal
+*       in the Software without restriction, including without limitation the rights
+*       to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*       copies of the Software, and to permit persons to whom the Software is
+*       furnished to do so, subject to the following conditions:
+*
+*       The above copyright notice and this permission notice shall be included in all
+*       copies or substantial portions of the Software.
+*
+*       THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*       IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*       FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*       AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*       LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*       OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*       SOFTWARE.
+*
+*************************************************************************/
+
+/**
+@file bench_check.c
+@author Dimitri Dening
+@date 17.10.2026
+@copyright (C) 2026 Dimitri Dening, MIT License
+@brief Compares a benchmark run against the recorded baseline.
+
+Reads the JSON lines of bench_runner, one per scenario and SCL frequency, and
+matches them by scenario and scl_hz. ISR cycles per transaction, per byte and
+the maximum cycles of every TWSR branch must not exceed the baseline by more
+than the tolerance. A scenario or branch missing from the run fails as well.
+Exits non-zero on any regression.
+*/
+
+/* General libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_LINE_MAX      2048
+#define BENCH_RESULTS_MAX   64
+
+typedef struct {
+	char line[BENCH_LINE_MAX];
+	char scenario[32];
+	double scl_hz;
+} result_t;
+
+typedef struct {
+	result_t results[BENCH_RESULTS_MAX];
+	unsigned count;
+} results_t;
+
+/* Number following "key": in the JSON object, -1 if absent */
+static double json_number(const char* object, const char* key) {
+
+	char pattern[48];
+	const char* value;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	value = strstr(object, pattern);
+
+	return value != NULL ? strtod(value + strlen(pattern), NULL) : -1;
+}
+
+static int load(const char* path, results_t* results) {
+
+	FILE* file = fopen(path, "r");
+	result_t* result;
+	const char* scenario;
+
+	if (file == NULL) {
+		fprintf(stderr, "bench_check: cannot open %s\n", path);
+		return 0;
+	}
+
+	results->count = 0;
+
+	while (results->count < BENCH_RESULTS_MAX) {
+		result = &results->results[results->count];
+
+		if (fgets(result->line, sizeof(result->line), file) == NULL) {
+			break;
+		}
+
+		scenario = strstr(result->line, "\"scenario\":\"");
+
+		if (scenario == NULL || sscanf(scenario + 12, "%31[^\"]", result->scenario) != 1) {
+			continue;
+		}
+
+		result->scl_hz = json_number(result->line, "scl_hz");
+		results->count++;
+	}
+
+	fclose(file);
+
+	return 1;
+}
+
+static const result_t* find(const results_t* results, const result_t* reference) {
+
+	for (unsigned i = 0; i < results->count; i++) {
+		if (strcmp(results->results[i].scenario, reference->scenario) == 0 && results->results[i].scl_hz == reference->scl_hz) {
+			return &results->results[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* 1 if value exceeds the reference by more than tolerance percent */
+static int regressed(const result_t* reference, const char* metric, double expected, double value, double tolerance) {
+
+	if (value >= 0 && value <= expected * (1.0 + tolerance / 100.0)) {
+		return 0;
+	}
+
+	printf("REGRESSION %s @ %.0f Hz: %s %.1f, baseline %.1f\n", reference->scenario, reference->scl_hz, metric, value, expected);
+
+	return 1;
+}
+
+static unsigned compare(const result_t* reference, const result_t* current, double tolerance) {
+
+	static const char* metrics[] = { "isr_cycles_per_transaction", "isr_cycles_per_byte" };
+	const char* branch = strstr(reference->line, "\"branches\":");
+	const char* current_branches = strstr(current->line, "\"branches\":");
+	unsigned failures = 0;
+	char status[8];
+	char metric[16];
+	const char* found;
+
+	for (unsigned i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+		failures += regressed(reference, metrics[i], json_number(reference->line, metrics[i]), json_number(current->line, metrics[i]), tolerance);
+	}
+
+	if (branch == NULL || current_branches == NULL) {
+		return failures;
+	}
+
+	// Branches are keyed by TWSR status: "0x08":{"calls":..,"avg":..,"max":..}
+	while ((branch = strstr(branch, "\"0x")) != NULL) {
+		memcpy(status, branch, 6);
+		status[6] = '\0';
+		found = strstr(current_branches, status);
+		snprintf(metric, sizeof(metric), "%.4s max", branch + 1);
+
+		failures += regressed(reference, metric, json_number(branch, "max"), found != NULL ? json_number(found, "max") : -1, tolerance);
+		branch += 6;
+	}
+
+	return failures;
+}
+
+int main(int argc, char* argv[]) {
+
+	static results_t baseline;
+	static results_t current;
+	double tolerance;
+	unsigned failures = 0;
+	const result_t* result;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s baseline.json bench.json tolerance_percent\n", argv[0]);
+		return 2;
+	}
+
+	tolerance = strtod(argv[3], NULL);
+
+	if (!load(argv[1], &baseline) || !load(argv[2], &current)) {
+		return 2;
+	}
+
+	if (baseline.count == 0) {
+		fprintf(stderr, "bench_check: %s holds no results, record one with make baseline\n", argv[1]);
+		return 2;
+	}
+
+	for (unsigned i = 0; i < baseline.count; i++) {
+		result = find(&current, &baseline.results[i]);
+
+		if (result == NULL) {
+			printf("MISSING %s @ %.0f Hz\n", baseline.results[i].scenario, baseline.results[i].scl_hz);
+			failures++;
+			continue;
+		}
+
+		failures += compare(&baseline.results[i], result, tolerance);
+	}
+
+	printf("bench_check: %u scenarios, %u regressions (tolerance %.1f %%)\n", baseline.count, failures, tolerance);
+
+	return failures != 0;
+}
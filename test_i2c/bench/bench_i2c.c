@@ -0,0 +1,126 @@
+/*************************************************************************
+* Title		: I2C ISR Benchmark (firmware)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: AVR-GCC, simavr
+* Hardware	: Atmega2560 (simulated)
+* License	: MIT License
+* Usage		: make -C test_i2c/bench bench
+*
+*       Copyright (C) 2026 Dimitri Dening
+*
+*       Permission is hereby granted, free of charge, to any person obtaining a copy
+*       of this software and associated documentation files (the "Software"), to deal
+*       in the Software without restriction, including without limitation the rights
+*       to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*       copies of the Software, and to permit persons to whom the Software is
+*       furnished to do so, subject to the following conditions:
+*
+*       The above copyright notice and this permission notice shall be included in all
+*       copies or substantial portions of the Software.
+*
+*       THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*       IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*       FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*       AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*       LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*       OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*       SOFTWARE.
+*
+* NOTES:
+*	Runs fixed workloads at several SCL frequencies. Scenario boundaries are
+*	signalled through GPIOR0 (scenario id, 0 = none) and GPIOR1 (number of
+*	transactions), bench_runner measures the cycles.
+*************************************************************************/
+
+/* Define CPU frequency in Hz here if not defined in Makefile */
+#ifndef F_CPU
+#define F_CPU 10000000UL
+#endif
+
+/* General libraries */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+/* User defined libraries */
+#include "avr_mcu_section.h"
+#include "i2c.h"
+#include "bench_i2c.h"
+
+AVR_MCU(F_CPU, "atmega2560");
+
+static uint8_t tx_buffer[BENCH_BLOCK_SIZE + 1];
+static uint8_t rx_buffer[BENCH_BLOCK_SIZE];
+
+static void bench_transaction(device_t* device, uint8_t scenario) {
+
+	payload_t* payload;
+	i2c_handle_t handle;
+
+	switch (scenario) {
+		case BENCH_WRITE_1:
+			payload = i2c_payload_create(PRIORITY_NORMAL, device, tx_buffer, 2, NULL);
+			handle = i2c_track(payload);
+			i2c_write(payload);
+			break;
+
+		case BENCH_WRITE_BLOCK:
+			payload = i2c_payload_create(PRIORITY_NORMAL, device, tx_buffer, BENCH_BLOCK_SIZE + 1, NULL);
+			handle = i2c_track(payload);
+			i2c_write(payload);
+			break;
+
+		case BENCH_READ_BLOCK:
+			payload = i2c_payload_create(PRIORITY_NORMAL, device, rx_buffer, BENCH_BLOCK_SIZE, NULL);
+			handle = i2c_track(payload);
+			i2c_read(payload);
+			break;
+
+		default:
+			payload = i2c_payload_create(PRIORITY_NORMAL, device, tx_buffer, 1, NULL);
+			handle = i2c_track(payload);
+			i2c_write_read(payload, rx_buffer, BENCH_BLOCK_SIZE);
+			break;
+	}
+
+	i2c_wait(handle);
+}
+
+int main(void) {
+
+	static const uint32_t frequencies[] = { I2C_STANDARD_MODE, 200000, I2C_FAST_MODE };
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+	device_t* device = i2c_create_device(BENCH_DEVICE_ADDR);
+
+	for (uint8_t i = 0; i <= BENCH_BLOCK_SIZE; i++) {
+		tx_buffer[i] = i;
+	}
+
+	for (uint8_t f = 0; f < sizeof(frequencies) / sizeof(frequencies[0]); f++) {
+
+		cli();
+		config.scl_target_frequency = frequencies[f];
+		i2c_init(&config);
+		sei();
+
+		for (uint8_t scenario = BENCH_WRITE_1; scenario <= BENCH_WRITE_READ_BLOCK; scenario++) {
+
+			GPIOR1 = BENCH_TRANSACTIONS;
+			GPIOR0 = scenario;
+
+			for (uint8_t n = 0; n < BENCH_TRANSACTIONS; n++) {
+				bench_transaction(device, scenario);
+			}
+
+			GPIOR0 = BENCH_NONE;
+		}
+	}
+
+	// Sleeping with interrupts off ends the simulation
+	cli();
+	sleep_cpu();
+
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*************************************************************************
+* Title		: I2C ISR Benchmark
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: AVR-GCC, simavr
+* Hardware	: Atmega2560 (simulated)
+* License	: MIT License
+*
+* NOTES:
+*	Shared between the firmware (bench_i2c.c) and the simavr runner (bench_runner.c).
+*************************************************************************/
+#ifndef BENCH_I2C_H_
+#define BENCH_I2C_H_
+
+#define BENCH_DEVICE_ADDR     0x50
+#define BENCH_BLOCK_SIZE      16
+#define BENCH_TRANSACTIONS    32
+
+/* Scenario ids written to GPIOR0 */
+#define BENCH_NONE              0
+#define BENCH_WRITE_1           1 // Register + 1 data byte
+#define BENCH_WRITE_BLOCK       2 // Register + BENCH_BLOCK_SIZE data bytes
+#define BENCH_READ_BLOCK        3 // BENCH_BLOCK_SIZE data bytes
+#define BENCH_WRITE_READ_BLOCK  4 // Register, repeated START, BENCH_BLOCK_SIZE data bytes
+
+#endif /* BENCH_I2C_H_ */
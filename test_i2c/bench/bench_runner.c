@@ -0,0 +1,283 @@
+/*************************************************************************
+* Title		: bench_runner.c
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host), simavr
+* Hardware	: Atmega2560 (simavr)
+* License	: MIT License
+* Usage		: see Doxygen manual
+*
+*       Copyright (C) 2026 Dimitri Dening
+*
+*       Permission is hereby granted, free of charge, to any person obtaining a copy
+*       of this software and associated documentation files (the "Software"), to deal
+*       in the Software without restriction, including without limitation the rights
+*       to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*       copies of the Software, and to permit persons to whom the Software is
+*       furnished to do so, subject to the following conditions:
+*
+*       The above copyright notice and this permission notice shall be included in all
+*       copies or substantial portions of the Software.
+*
+*       THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*       IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*       FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*       AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*       LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*       OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*       SOFTWARE.
+*
+*************************************************************************/
+
+/**
+@file bench_runner.c
+@author Dimitri Dening
+@date 17.10.2026
+@copyright (C) 2026 Dimitri Dening, MIT License
+@brief Cycle-accurate ISR benchmark for the I2C driver on simavr.
+
+Loads bench_i2c.elf, attaches a virtual register-map slave to the simulated
+TWI and single-steps the core. Every ISR(TWI_vect) invocation is timed from
+the vector jump to its RETI, so prologue and epilogue are included, and is
+attributed to the TWSR status it served. One JSON object per scenario and
+SCL frequency is printed to stdout.
+*/
+
+/* General libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* simavr */
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "avr_twi.h"
+
+/* User defined libraries */
+#include "bench_i2c.h"
+
+// ATmega2560 addresses (data space) and TWI vector
+#define BENCH_GPIOR0     0x3E
+#define BENCH_GPIOR1     0x4A
+#define BENCH_TWBR       0xB8
+#define BENCH_TWSR       0xB9
+#define BENCH_TWI_VECTOR (39 * 4)
+#define BENCH_OPCODE_RETI 0x9518
+
+static const char* scenario_names[] = {
+	[BENCH_WRITE_1]          = "write_1",
+	[BENCH_WRITE_BLOCK]      = "write_block",
+	[BENCH_READ_BLOCK]       = "read_block",
+	[BENCH_WRITE_READ_BLOCK] = "write_read_block",
+};
+
+typedef struct branch_t {
+	uint32_t calls;
+	uint64_t cycles;
+	uint32_t max;
+} branch_t;
+
+/* Virtual slave, first written byte selects the register */
+static struct {
+	avr_irq_t* irq;
+	uint8_t selected;
+	uint8_t index;
+	uint8_t pointer;
+	uint8_t regs[256];
+	uint32_t bytes;
+} slave;
+
+static struct {
+	uint8_t id;
+	uint64_t start;
+	uint32_t scl;
+	uint32_t isr_calls;
+	uint64_t isr_cycles;
+	branch_t branch[256];
+} scenario;
+
+static void slave_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+
+	avr_twi_msg_irq_t v;
+
+	v.u.v = value;
+
+	if (v.u.twi.msg & TWI_COND_STOP) {
+		slave.selected = 0;
+	}
+
+	if (v.u.twi.msg & TWI_COND_ADDR) {
+		slave.selected = ((v.u.twi.addr >> 1) == BENCH_DEVICE_ADDR) ? v.u.twi.addr : 0;
+		slave.index = 0;
+
+		if (slave.selected) {
+			avr_raise_irq(slave.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, slave.selected, 1));
+		}
+		return;
+	}
+
+	if (!slave.selected) {
+		return;
+	}
+
+	if (v.u.twi.msg & TWI_COND_WRITE) {
+		avr_raise_irq(slave.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, slave.selected, 1));
+
+		if (slave.index++ == 0) {
+			slave.pointer = v.u.twi.data;
+		} else {
+			slave.regs[slave.pointer++] = v.u.twi.data;
+		}
+
+		slave.bytes++;
+	}
+
+	if (v.u.twi.msg & TWI_COND_READ) {
+		avr_raise_irq(slave.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, slave.selected, slave.regs[slave.pointer++]));
+		slave.bytes++;
+	}
+}
+
+static void slave_attach(avr_t* avr) {
+
+	static const char* names[2] = {
+		[TWI_IRQ_INPUT]  = "8>bench.slave.out",
+		[TWI_IRQ_OUTPUT] = "32<bench.slave.in",
+	};
+
+	slave.irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+	avr_irq_register_notify(slave.irq + TWI_IRQ_OUTPUT, slave_hook, NULL);
+
+	avr_connect_irq(slave.irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+	avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), slave.irq + TWI_IRQ_OUTPUT);
+}
+
+static uint32_t scl_frequency(avr_t* avr) {
+
+	static const uint8_t prescaler_values[] = {1, 4, 16, 64};
+	uint8_t twbr = avr->data[BENCH_TWBR];
+	uint8_t twps = avr->data[BENCH_TWSR] & 0x03;
+
+	return avr->frequency / (16 + 2UL * twbr * prescaler_values[twps]);
+}
+
+static void scenario_begin(avr_t* avr, uint8_t id) {
+
+	memset(&scenario, 0, sizeof(scenario));
+
+	scenario.id = id;
+	scenario.start = avr->cycle;
+	scenario.scl = scl_frequency(avr);
+	slave.bytes = 0;
+}
+
+static void scenario_end(avr_t* avr) {
+
+	uint32_t transactions = avr->data[BENCH_GPIOR1];
+	uint64_t cycles = avr->cycle - scenario.start;
+	double seconds = (double)cycles / avr->frequency;
+	const char* separator = "";
+
+	printf("{\"scenario\":\"%s\",\"f_cpu\":%u,\"scl_hz\":%u,\"transactions\":%u,\"bytes\":%u,"
+		"\"cycles\":%llu,\"bytes_per_sec\":%.0f,\"isr_calls\":%u,\"isr_cycles\":%llu,"
+		"\"isr_cycles_per_transaction\":%.1f,\"isr_cycles_per_byte\":%.1f,\"isr_load\":%.4f,\"branches\":{",
+		scenario_names[scenario.id], (unsigned)avr->frequency, scenario.scl, transactions, slave.bytes,
+		(unsigned long long)cycles, slave.bytes / seconds, scenario.isr_calls, (unsigned long long)scenario.isr_cycles,
+		(double)scenario.isr_cycles / transactions, slave.bytes ? (double)scenario.isr_cycles / slave.bytes : 0.0,
+		(double)scenario.isr_cycles / cycles);
+
+	for (unsigned status = 0; status < 256; status++) {
+		branch_t* branch = &scenario.branch[status];
+
+		if (branch->calls == 0) {
+			continue;
+		}
+
+		printf("%s\"0x%02X\":{\"calls\":%u,\"avg\":%.1f,\"max\":%u}", separator, status,
+			branch->calls, (double)branch->cycles / branch->calls, branch->max);
+		separator = ",";
+	}
+
+	printf("}}\n");
+
+	scenario.id = BENCH_NONE;
+}
+
+int main(int argc, char* argv[]) {
+
+	elf_firmware_t firmware = {{0}};
+	avr_t* avr;
+	uint8_t in_isr = 0;
+	uint8_t isr_status = 0;
+	uint64_t isr_start = 0;
+	int state;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s bench_i2c.elf\n", argv[0]);
+		return 2;
+	}
+
+	if (elf_read_firmware(argv[1], &firmware) != 0) {
+		fprintf(stderr, "bench: cannot load %s\n", argv[1]);
+		return 2;
+	}
+
+	avr = avr_make_mcu_by_name(firmware.mmcu);
+
+	if (avr == NULL) {
+		fprintf(stderr, "bench: unknown MCU '%s'\n", firmware.mmcu);
+		return 2;
+	}
+
+	avr_init(avr);
+	avr_load_firmware(avr, &firmware);
+	slave_attach(avr);
+
+	do {
+		avr_flashaddr_t pc = avr->pc;
+		uint8_t reti = in_isr && (avr->flash[pc] | (avr->flash[pc + 1] << 8)) == BENCH_OPCODE_RETI;
+		uint8_t marker;
+
+		if (!in_isr && pc == BENCH_TWI_VECTOR) {
+			in_isr = 1;
+			isr_start = avr->cycle;
+			isr_status = avr->data[BENCH_TWSR] & 0xF8;
+		}
+
+		state = avr_run(avr);
+
+		if (reti) {
+			uint32_t cycles = (uint32_t)(avr->cycle - isr_start);
+			branch_t* branch = &scenario.branch[isr_status];
+
+			in_isr = 0;
+
+			if (scenario.id != BENCH_NONE) {
+				scenario.isr_calls++;
+				scenario.isr_cycles += cycles;
+				branch->calls++;
+				branch->cycles += cycles;
+
+				if (cycles > branch->max) {
+					branch->max = cycles;
+				}
+			}
+		}
+
+		marker = avr->data[BENCH_GPIOR0];
+
+		if (marker != scenario.id) {
+			if (scenario.id != BENCH_NONE) {
+				scenario_end(avr);
+			}
+
+			if (marker != BENCH_NONE) {
+				scenario_begin(avr, marker);
+			}
+		}
+	} while (state != cpu_Done && state != cpu_Crashed);
+
+	return state == cpu_Crashed;
+}
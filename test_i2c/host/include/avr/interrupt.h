@@ -0,0 +1,31 @@
+/*************************************************************************
+* Title		: avr/interrupt.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI, see sim_twi.h
+* License	: MIT License
+*
+* NOTES:
+*	ISRs become plain functions that the simulator dispatches.
+*************************************************************************/
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t sim_sreg_i; // Global interrupt flag
+
+#define ISR(vector, ...) void vector(void)
+
+#define cli() (sim_sreg_i = 0)
+#define sei() (sim_sreg_i = 1)
+
+#if defined(__AVR_ATmega328PB__)
+void TWI0_vect(void);
+void TWI1_vect(void);
+#else
+void TWI_vect(void);
+#endif
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
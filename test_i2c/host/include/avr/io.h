@@ -0,0 +1,95 @@
+/*************************************************************************
+* Title		: avr/io.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI, see sim_twi.h
+* License	: MIT License
+*
+* NOTES:
+*	Stand-in for the avr-libc header. TWCR and the GPIO registers used for
+*	bus recovery are routed through the simulator, every access advances it.
+*	The ATmega328PB build gets both of its TWIs.
+*************************************************************************/
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+/* TWCR bits */
+#define TWINT 7
+#define TWEA  6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC  3
+#define TWEN  2
+#define TWIE  0
+
+/* TWSR prescaler bits */
+#define TWPS1 1
+#define TWPS0 0
+
+/* One register set per simulated TWI */
+extern volatile uint8_t sim_twbr[];
+extern volatile uint8_t sim_twsr[];
+extern volatile uint8_t sim_twdr[];
+extern volatile uint8_t sim_twar[];
+extern volatile uint8_t sim_port[];
+
+volatile uint8_t* sim_twcr(uint8_t n);
+volatile uint8_t* sim_ddr(uint8_t n);
+volatile uint8_t* sim_pin(uint8_t n);
+
+#if defined(__AVR_ATmega328PB__)
+#define SIM_TWI_BUSES 2
+
+/* Port C and E pins */
+#define PC4 4
+#define PC5 5
+#define PE0 0
+#define PE1 1
+
+#define SIM_SDA0 PC4
+#define SIM_SCL0 PC5
+#define SIM_SDA1 PE0
+#define SIM_SCL1 PE1
+
+#define TWBR0 (sim_twbr[0])
+#define TWSR0 (sim_twsr[0])
+#define TWDR0 (sim_twdr[0])
+#define TWAR0 (sim_twar[0])
+#define TWCR0 (*sim_twcr(0))
+#define TWBR1 (sim_twbr[1])
+#define TWSR1 (sim_twsr[1])
+#define TWDR1 (sim_twdr[1])
+#define TWAR1 (sim_twar[1])
+#define TWCR1 (*sim_twcr(1))
+
+#define PORTC (sim_port[0])
+#define DDRC  (*sim_ddr(0))
+#define PINC  (*sim_pin(0))
+#define PORTE (sim_port[1])
+#define DDRE  (*sim_ddr(1))
+#define PINE  (*sim_pin(1))
+#else
+#define SIM_TWI_BUSES 1
+
+/* Port D pins */
+#define PD0 0
+#define PD1 1
+
+#define SIM_SDA0 PD1
+#define SIM_SCL0 PD0
+
+#define TWBR (sim_twbr[0])
+#define TWSR (sim_twsr[0])
+#define TWDR (sim_twdr[0])
+#define TWAR (sim_twar[0])
+#define TWCR (*sim_twcr(0))
+
+#define PORTD (sim_port[0])
+#define DDRD  (*sim_ddr(0))
+#define PIND  (*sim_pin(0))
+#endif
+
+#endif /* SIM_AVR_IO_H_ */
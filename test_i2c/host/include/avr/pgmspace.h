@@ -0,0 +1,25 @@
+/*************************************************************************
+* Title		: avr/pgmspace.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI, see sim_twi.h
+* License	: MIT License
+*
+* NOTES:
+*	Flash and RAM share one address space on the host.
+*************************************************************************/
+#ifndef SIM_AVR_PGMSPACE_H_
+#define SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+
+typedef uintptr_t uint_farptr_t;
+
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_byte_far(address) (*(const uint8_t*)(address))
+#define pgm_get_far_address(var) ((uint_farptr_t)&(var))
+
+#endif /* SIM_AVR_PGMSPACE_H_ */
@@ -0,0 +1,24 @@
+/*************************************************************************
+* Title		: avr/sleep.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI, see sim_twi.h
+* License	: MIT License
+*
+* NOTES:
+*	sleep_cpu() runs the simulator until the next interrupt was served.
+*************************************************************************/
+#ifndef SIM_AVR_SLEEP_H_
+#define SIM_AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE 0
+
+void sim_sleep(void);
+
+#define set_sleep_mode(mode) ((void)(mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() sim_sleep()
+
+#endif /* SIM_AVR_SLEEP_H_ */
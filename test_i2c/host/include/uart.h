@@ -0,0 +1,19 @@
+/*************************************************************************
+* Title		: uart.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* License	: MIT License
+*
+* NOTES:
+*	Test output goes to stdout instead of the UART.
+*************************************************************************/
+#ifndef SIM_UART_H_
+#define SIM_UART_H_
+
+#include <stdio.h>
+
+#define uart_init()
+#define uart_put(...) do { printf(__VA_ARGS__); printf("\n"); } while (0)
+
+#endif /* SIM_UART_H_ */
@@ -0,0 +1,25 @@
+/*************************************************************************
+* Title		: util/atomic.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI, see sim_twi.h
+* License	: MIT License
+*************************************************************************/
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+
+#include <avr/interrupt.h>
+
+static inline uint8_t __sim_atomic_enter(void) {
+	uint8_t sreg_i = sim_sreg_i;
+	sim_sreg_i = 0;
+	return sreg_i;
+}
+
+#define ATOMIC_RESTORESTATE
+
+#define ATOMIC_BLOCK(type) \
+	for (uint8_t __sreg_i = __sim_atomic_enter(), __todo = 1; __todo; __todo = 0, sim_sreg_i = __sreg_i)
+
+#endif /* SIM_UTIL_ATOMIC_H_ */
@@ -0,0 +1,22 @@
+/*************************************************************************
+* Title		: util/delay.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI, see sim_twi.h
+* License	: MIT License
+*
+* NOTES:
+*	Delays advance the simulated time, timers do not fire while delaying.
+*************************************************************************/
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+
+#include <stdint.h>
+
+void sim_delay_us(uint32_t us);
+
+#define _delay_us(us) sim_delay_us((uint32_t)(us))
+#define _delay_ms(ms) sim_delay_us((uint32_t)(ms) * 1000UL)
+
+#endif /* SIM_UTIL_DELAY_H_ */
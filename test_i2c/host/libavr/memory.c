@@ -0,0 +1,33 @@
+/*************************************************************************
+* Title		: memory.c (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* License	: MIT License
+*************************************************************************/
+#include <stdlib.h>
+
+#include "memory.h"
+
+payload_t* payload_create_i2c(priority_t priority, struct device_t* device, uint8_t* data, uint8_t number_of_bytes, callback_fn callback) {
+
+	payload_t* payload = (payload_t*)malloc(sizeof(payload_t));
+
+	if (payload == NULL) {
+		return NULL;
+	}
+
+	payload->priority = priority;
+	payload->i2c.device = device;
+	payload->i2c.data = data;
+	payload->i2c.number_of_bytes = number_of_bytes;
+	payload->i2c.mode = WRITE;
+	payload->i2c.callback = callback;
+
+	return payload;
+}
+
+void payload_free_i2c(payload_t* payload) {
+
+	free(payload);
+}
@@ -0,0 +1,46 @@
+/*************************************************************************
+* Title		: memory.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* License	: MIT License
+*
+* NOTES:
+*	Host stand-in for the libAVR payload definitions used by the driver.
+*************************************************************************/
+#ifndef SIM_MEMORY_H_
+#define SIM_MEMORY_H_
+
+#include <stdint.h>
+
+struct device_t;
+
+typedef void (*callback_fn)(void*);
+
+typedef enum {
+	PRIORITY_LOW,
+	PRIORITY_NORMAL,
+	PRIORITY_HIGH,
+} priority_t;
+
+typedef enum {
+	READ,
+	WRITE,
+} access_mode_t;
+
+typedef struct payload_t {
+	priority_t priority;
+	struct {
+		struct device_t* device;
+		uint8_t* data;
+		uint8_t number_of_bytes;
+		access_mode_t mode;
+		callback_fn callback;
+	} i2c;
+} payload_t;
+
+payload_t* payload_create_i2c(priority_t priority, struct device_t* device, uint8_t* data, uint8_t number_of_bytes, callback_fn callback);
+
+void payload_free_i2c(payload_t* payload);
+
+#endif /* SIM_MEMORY_H_ */
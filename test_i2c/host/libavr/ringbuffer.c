@@ -0,0 +1,52 @@
+/*************************************************************************
+* Title		: ringbuffer.c (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* License	: MIT License
+*************************************************************************/
+#include <stddef.h>
+
+#include "ringbuffer.h"
+
+queue_t* queue_init(queue_t* queue) {
+
+	queue->head = 0;
+	queue->tail = 0;
+	queue->count = 0;
+
+	return queue;
+}
+
+uint8_t queue_enqueue(queue_t* queue, payload_t* payload) {
+
+	if (queue->count == QUEUE_SIZE) {
+		return 1;
+	}
+
+	queue->buffer[queue->tail] = payload;
+	queue->tail = (queue->tail + 1) % QUEUE_SIZE;
+	queue->count++;
+
+	return 0;
+}
+
+payload_t* queue_dequeue(queue_t* queue) {
+
+	payload_t* payload;
+
+	if (queue->count == 0) {
+		return NULL;
+	}
+
+	payload = queue->buffer[queue->head];
+	queue->head = (queue->head + 1) % QUEUE_SIZE;
+	queue->count--;
+
+	return payload;
+}
+
+uint8_t queue_empty(queue_t* queue) {
+
+	return queue->count == 0;
+}
@@ -0,0 +1,36 @@
+/*************************************************************************
+* Title		: ringbuffer.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* License	: MIT License
+*
+* NOTES:
+*	Host stand-in for the libAVR payload queue used by the driver.
+*************************************************************************/
+#ifndef SIM_RINGBUFFER_H_
+#define SIM_RINGBUFFER_H_
+
+#include <stdint.h>
+
+#include "memory.h"
+
+#define QUEUE_SIZE 16
+
+typedef struct queue_t {
+	payload_t* buffer[QUEUE_SIZE];
+	uint8_t head;
+	uint8_t tail;
+	uint8_t count;
+} queue_t;
+
+queue_t* queue_init(queue_t* queue);
+
+/* Returns 0 on success, 1 if the queue is full */
+uint8_t queue_enqueue(queue_t* queue, payload_t* payload);
+
+payload_t* queue_dequeue(queue_t* queue);
+
+uint8_t queue_empty(queue_t* queue);
+
+#endif /* SIM_RINGBUFFER_H_ */
@@ -0,0 +1,20 @@
+/*************************************************************************
+* Title		: utils.h (host)
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* License	: MIT License
+*
+* NOTES:
+*	Host stand-in for the libAVR helpers used by the driver.
+*************************************************************************/
+#ifndef SIM_UTILS_H_
+#define SIM_UTILS_H_
+
+#ifndef ARRAY_LEN
+# define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#define SET_PIN_OUTPUT(port, pin) ((port) |= (1 << (pin)))
+
+#endif /* SIM_UTILS_H_ */
@@ -0,0 +1,696 @@
+/*************************************************************************
+* Title		: sim_twi.c
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI
+* License	: MIT License
+* Usage		: see Doxygen manual
+*
+*       Copyright (C) 2026 Dimitri Dening
+*
+*       Permission is hereby granted, free of charge, to any person obtaining a copy
+*       of this software and associated documentation files (the "Software"), to deal
+*       in the Software without restriction, including without limitation the rights
+*       to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*       copies of the Software, and to permit persons to whom the Software is
+*       furnished to do so, subject to the following conditions:
+*
+*       The above copyright notice and this permission notice shall be included in all
+*       copies or substantial portions of the Software.
+*
+*       THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*       IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*       FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*       AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*       LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*       OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*       SOFTWARE.
+*
+*************************************************************************/
+
+/* General libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* User defined libraries */
+#include "sim_twi.h"
+
+// TWI status codes produced by the bus
+#define SIM_START           0x08
+#define SIM_REPEAT_START    0x10
+#define SIM_TX_ADDR_ACK     0x18
+#define SIM_TX_ADDR_NACK    0x20
+#define SIM_TX_DATA_ACK     0x28
+#define SIM_TX_DATA_NACK    0x30
+#define SIM_RX_ADDR_ACK     0x40
+#define SIM_RX_ADDR_NACK    0x48
+#define SIM_RX_DATA_ACK     0x50
+#define SIM_RX_DATA_NACK    0x58
+#define SIM_ARB_LOST        0x38
+#define SIM_SR_ADDR_ACK     0x60
+#define SIM_SR_ARB_LOST     0x68
+#define SIM_SR_DATA_ACK     0x80
+#define SIM_SR_DATA_NACK    0x88
+#define SIM_SR_STOP         0xA0
+#define SIM_ST_ADDR_ACK     0xA8
+#define SIM_ST_ARB_LOST     0xB0
+#define SIM_ST_DATA_ACK     0xB8
+#define SIM_ST_DATA_NACK    0xC0
+#define SIM_ST_LAST_DATA    0xC8
+
+// Bits a rival master keeps the bus for after winning arbitration
+#define SIM_RIVAL_BITS      40
+
+// Upper bound of ISR calls in one sim_run(), catches an ISR that never clears TWINT
+#define SIM_MAX_ISR_CALLS   100000
+
+typedef enum {
+	BUS_IDLE,       // No START issued by us
+	BUS_ADDRESS,    // START sent, waiting for SLA+R/W
+	BUS_TRANSMIT,   // Master transmitter, slave ACKed SLA+W
+	BUS_RECEIVE,    // Master receiver, slave ACKed SLA+R
+	BUS_NACKED,     // Address or data NACKed, waiting for STOP/START
+	BUS_HUNG,       // Slave holds SDA low, nothing completes
+	BUS_ADDRESSED,  // Host addressed us, writing
+	BUS_RESTART,    // Host sent a repeated START, SLA+R follows
+	BUS_SENDING,    // Host addressed us, reading
+	BUS_RELEASED,   // Host transfer over, the next command ends it
+	BUS_RIVAL,      // Another master owns the bus, commands wait for its STOP
+} bus_state_t;
+
+/* One simulated TWI with its own bus and slaves */
+typedef struct sim_twi_t {
+	uint8_t twcr;
+	uint8_t ddr;
+	uint8_t pin;
+	uint8_t last_ddr;
+	uint8_t sda;
+	uint8_t scl;
+	bus_state_t state;
+	sim_slave_t* slaves;
+	sim_slave_t* selected;
+	sim_slave_t* hung;
+	uint16_t byte_index;  // Bytes of the current write phase
+	uint8_t lose_arbitration; // Address phases lost to a rival master
+	uint32_t rival_us;    // Bus time of that rival, 0: SIM_RIVAL_BITS
+	uint64_t rival_until; // End of the rival transfer, see BUS_RIVAL
+	uint8_t held;         // Command written while the rival owns the bus
+	uint8_t host_wins;    // The host transfer starts by winning our next address phase
+
+	/* External master driving our TWI as slave, see sim_host_transfer() */
+	const uint8_t* host_tx;
+	uint16_t host_tx_len;
+	uint8_t* host_rx;
+	uint16_t host_rx_len;
+	uint16_t host_index;
+	uint8_t host_address;
+} sim_twi_t;
+
+/* Register file */
+volatile uint8_t sim_twbr[SIM_TWI_BUSES];
+volatile uint8_t sim_twsr[SIM_TWI_BUSES];
+volatile uint8_t sim_twdr[SIM_TWI_BUSES];
+volatile uint8_t sim_twar[SIM_TWI_BUSES];
+volatile uint8_t sim_port[SIM_TWI_BUSES];
+volatile uint8_t sim_sreg_i;
+
+sim_stats_t sim_stats;
+
+static sim_twi_t twis[SIM_TWI_BUSES];
+
+static uint64_t now_ns;
+static uint64_t timer_due_ns;
+static uint32_t timer_period_ns;
+static void (*timer_handler)(void);
+
+static uint8_t sim_index(sim_twi_t* twi) {
+
+	return (uint8_t)(twi - twis);
+}
+
+static uint32_t sim_bit_ns(sim_twi_t* twi) {
+
+	static const uint8_t prescaler_values[] = {1, 4, 16, 64};
+	uint8_t n = sim_index(twi);
+	uint32_t divider = 16 + 2UL * sim_twbr[n] * prescaler_values[sim_twsr[n] & 0x03];
+
+	return (uint32_t)((1000000000ULL * divider) / F_CPU);
+}
+
+static void sim_bus_time(sim_twi_t* twi, uint8_t bits) {
+
+	now_ns += (uint64_t)bits * sim_bit_ns(twi);
+}
+
+static sim_slave_t* sim_find(sim_twi_t* twi, uint8_t address) {
+
+	for (sim_slave_t* slave = twi->slaves; slave != NULL; slave = slave->next) {
+		if (slave->address == address) {
+			return slave;
+		}
+	}
+
+	return NULL;
+}
+
+/* Completes a bus operation: TWSR takes the status and TWINT is set. */
+static void sim_complete(sim_twi_t* twi, uint8_t status) {
+
+	uint8_t n = sim_index(twi);
+
+	sim_twsr[n] = (uint8_t)((sim_twsr[n] & 0x03) | status);
+	twi->twcr |= (1 << TWINT);
+}
+
+static void sim_stop(sim_twi_t* twi) {
+
+	if (twi->state != BUS_IDLE) {
+		sim_stats.stops++;
+		sim_bus_time(twi, 1);
+	}
+
+	twi->state = BUS_IDLE;
+	twi->selected = NULL;
+}
+
+/* Another master owns the bus for ns, timer interrupts keep firing meanwhile */
+static void sim_rival_begin(sim_twi_t* twi, uint64_t ns) {
+
+	twi->state = BUS_RIVAL;
+	twi->rival_until = now_ns + ns;
+	twi->held = 0;
+}
+
+/* Addresses our TWI as slave, after winning arbitration against it or on an idle bus */
+static void sim_host_begin(sim_twi_t* twi, uint8_t arbitration_lost) {
+
+	twi->host_index = 0;
+
+	if (twi->host_tx_len != 0) {
+		twi->state = BUS_ADDRESSED;
+		sim_complete(twi, arbitration_lost ? SIM_SR_ARB_LOST : SIM_SR_ADDR_ACK);
+	} else {
+		twi->state = BUS_SENDING;
+		sim_complete(twi, arbitration_lost ? SIM_ST_ARB_LOST : SIM_ST_ADDR_ACK);
+	}
+}
+
+static void sim_address(sim_twi_t* twi) {
+
+	uint8_t twdr = sim_twdr[sim_index(twi)];
+	uint8_t read = twdr & 0x01;
+	sim_slave_t* slave = sim_find(twi, twdr >> 1);
+
+	sim_bus_time(twi, 9);
+	twi->byte_index = 0;
+
+	if (twi->host_wins && (twi->twcr & (1 << TWEA)) && (sim_twar[sim_index(twi)] >> 1) == twi->host_address) {
+		twi->host_wins = 0;
+		sim_stats.arbitration_losses++;
+		sim_host_begin(twi, 1);
+		return;
+	}
+
+	if (twi->lose_arbitration) {
+		// The rival goes on with its transfer, the TWI sees the bus free after its STOP
+		twi->lose_arbitration--;
+		sim_stats.arbitration_losses++;
+		sim_rival_begin(twi, twi->rival_us != 0 ? (uint64_t)twi->rival_us * 1000 : (uint64_t)SIM_RIVAL_BITS * sim_bit_ns(twi));
+		sim_complete(twi, SIM_ARB_LOST);
+		return;
+	}
+
+	if (slave != NULL && slave->hold_bus) {
+		slave->hold_bus = 0;
+		twi->hung = slave;
+		twi->state = BUS_HUNG;
+		return;
+	}
+
+	if (slave == NULL || slave->nack_address) {
+		if (slave != NULL) {
+			slave->nack_address--;
+		}
+
+		twi->state = BUS_NACKED;
+		sim_complete(twi, read ? SIM_RX_ADDR_NACK : SIM_TX_ADDR_NACK);
+		return;
+	}
+
+	slave->addressed++;
+	twi->selected = slave;
+	twi->state = read ? BUS_RECEIVE : BUS_TRANSMIT;
+	sim_complete(twi, read ? SIM_RX_ADDR_ACK : SIM_TX_ADDR_ACK);
+}
+
+static void sim_transmit(sim_twi_t* twi) {
+
+	sim_slave_t* slave = twi->selected;
+	uint8_t twdr = sim_twdr[sim_index(twi)];
+
+	sim_bus_time(twi, 9);
+
+	if (twi->byte_index++ == 0) {
+		slave->pointer = twdr;
+	} else {
+		slave->regs[slave->pointer++] = twdr;
+	}
+
+	slave->written++;
+
+	if (slave->nack_data_at != 0 && slave->nack_data_at == twi->byte_index) {
+		slave->nack_data_at = 0;
+		twi->state = BUS_NACKED;
+		sim_complete(twi, SIM_TX_DATA_NACK);
+		return;
+	}
+
+	sim_complete(twi, SIM_TX_DATA_ACK);
+}
+
+static void sim_receive(sim_twi_t* twi, uint8_t ack) {
+
+	sim_slave_t* slave = twi->selected;
+
+	sim_bus_time(twi, 9);
+
+	sim_twdr[sim_index(twi)] = slave->regs[slave->pointer++];
+	slave->read++;
+
+	sim_complete(twi, ack ? SIM_RX_DATA_ACK : SIM_RX_DATA_NACK);
+}
+
+/* Next step of the host transfer, acknowledging the command just written */
+static void sim_host_step(sim_twi_t* twi, uint8_t command) {
+
+	uint8_t n = sim_index(twi);
+
+	sim_bus_time(twi, 9);
+
+	switch (twi->state) {
+		case BUS_ADDRESSED:
+			if (twi->host_index < twi->host_tx_len) {
+				sim_twdr[n] = twi->host_tx[twi->host_index++];
+				sim_complete(twi, (command & (1 << TWEA)) ? SIM_SR_DATA_ACK : SIM_SR_DATA_NACK);
+			} else {
+				twi->state = twi->host_rx_len != 0 ? BUS_RESTART : BUS_RELEASED;
+				sim_complete(twi, SIM_SR_STOP);
+			}
+			break;
+
+		case BUS_RESTART:
+			twi->host_index = 0;
+			twi->state = BUS_SENDING;
+			sim_complete(twi, SIM_ST_ADDR_ACK);
+			break;
+
+		case BUS_SENDING:
+			// TWDR holds the byte the ISR loaded, the host NACKs the last one
+			twi->host_rx[twi->host_index++] = sim_twdr[n];
+
+			if (twi->host_index < twi->host_rx_len) {
+				sim_complete(twi, (command & (1 << TWEA)) ? SIM_ST_DATA_ACK : SIM_ST_LAST_DATA);
+			} else {
+				twi->state = BUS_RELEASED;
+				sim_complete(twi, SIM_ST_DATA_NACK);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*
+ * Executes the command last written to TWCR. The simulator marks TWCR with
+ * TWWC once a command was taken, the driver never writes that bit, so a
+ * cleared TWWC means a new write.
+ */
+static void sim_process(sim_twi_t* twi) {
+
+	uint8_t command = twi->twcr;
+
+	if (twi->state == BUS_RIVAL) {
+		if (!(command & (1 << TWWC))) {
+			// TWINT clears at once, the command waits for the rival's STOP
+			twi->held = command;
+			twi->twcr = (uint8_t)((command & ~(1 << TWINT)) | (1 << TWWC));
+		}
+
+		if (now_ns < twi->rival_until) {
+			return;
+		}
+
+		twi->state = BUS_IDLE;
+
+		if (twi->held != 0) {
+			command = twi->twcr = twi->held;
+			twi->held = 0;
+		}
+	}
+
+	if (command & (1 << TWWC)) {
+		return;
+	}
+
+	twi->twcr = (uint8_t)((command & ~((1 << TWINT) | (1 << TWSTO))) | (1 << TWWC));
+
+	if (!(command & (1 << TWEN))) {
+		// TWI off, the pins belong to the GPIO port now
+		if (twi->state != BUS_HUNG) {
+			twi->state = BUS_IDLE;
+		}
+		twi->selected = NULL;
+		return;
+	}
+
+	if (!(command & (1 << TWINT)) || twi->state == BUS_HUNG) {
+		return;
+	}
+
+	if (twi->state >= BUS_ADDRESSED) {
+		if (twi->state != BUS_RELEASED) {
+			// A START requested meanwhile is dropped, the driver asks again
+			sim_host_step(twi, command);
+			return;
+		}
+
+		twi->state = BUS_IDLE;
+	}
+
+	if (command & (1 << TWSTO)) {
+		sim_stop(twi);
+	}
+
+	if (command & (1 << TWSTA)) {
+		sim_bus_time(twi, 1);
+
+		if (twi->state == BUS_IDLE) {
+			sim_stats.starts++;
+			twi->state = BUS_ADDRESS;
+			sim_complete(twi, SIM_START);
+		} else {
+			sim_stats.repeated_starts++;
+			twi->state = BUS_ADDRESS;
+			sim_complete(twi, SIM_REPEAT_START);
+		}
+		return;
+	}
+
+	switch (twi->state) {
+		case BUS_ADDRESS:  sim_address(twi); break;
+		case BUS_TRANSMIT: sim_transmit(twi); break;
+		case BUS_RECEIVE:  sim_receive(twi, command & (1 << TWEA)); break;
+		default: break;
+	}
+}
+
+/*
+ * Follows SCL while the driver bit-bangs the pins. A hung slave lets go of
+ * SDA after its stuck_clocks rising SCL edges.
+ */
+static void sim_gpio(sim_twi_t* twi) {
+
+	uint8_t scl_low_before = twi->last_ddr & (1 << twi->scl);
+	uint8_t scl_low_now = twi->ddr & (1 << twi->scl);
+
+	twi->last_ddr = twi->ddr;
+
+	if (twi->hung == NULL || !scl_low_before || scl_low_now) {
+		return;
+	}
+
+	if (twi->hung->stuck_clocks == 0 || --twi->hung->stuck_clocks == 0) {
+		twi->hung = NULL;
+		twi->state = BUS_IDLE;
+		sim_stats.recoveries++;
+	}
+}
+
+volatile uint8_t* sim_twcr(uint8_t n) {
+
+	sim_process(&twis[n]);
+
+	return &twis[n].twcr;
+}
+
+volatile uint8_t* sim_ddr(uint8_t n) {
+
+	sim_gpio(&twis[n]);
+
+	return &twis[n].ddr;
+}
+
+volatile uint8_t* sim_pin(uint8_t n) {
+
+	sim_twi_t* twi = &twis[n];
+	uint8_t sda_low;
+	uint8_t scl_low;
+
+	sim_gpio(twi);
+
+	sda_low = (twi->hung != NULL) || ((twi->ddr & (1 << twi->sda)) && !(sim_port[n] & (1 << twi->sda)));
+	scl_low = (twi->ddr & (1 << twi->scl)) && !(sim_port[n] & (1 << twi->scl));
+
+	twi->pin = (uint8_t)((sda_low ? 0 : (1 << twi->sda)) | (scl_low ? 0 : (1 << twi->scl)));
+
+	return &twi->pin;
+}
+
+void sim_delay_us(uint32_t us) {
+
+	for (uint8_t n = 0; n < SIM_TWI_BUSES; n++) {
+		sim_gpio(&twis[n]);
+	}
+
+	now_ns += (uint64_t)us * 1000;
+}
+
+void sim_reset(void) {
+
+	memset(twis, 0, sizeof(twis));
+
+	for (uint8_t n = 0; n < SIM_TWI_BUSES; n++) {
+		sim_twbr[n] = sim_twsr[n] = sim_twdr[n] = sim_twar[n] = sim_port[n] = 0;
+		twis[n].state = BUS_IDLE;
+	}
+
+	twis[0].sda = SIM_SDA0;
+	twis[0].scl = SIM_SCL0;
+#if SIM_TWI_BUSES > 1
+	twis[1].sda = SIM_SDA1;
+	twis[1].scl = SIM_SCL1;
+#endif
+
+	now_ns = 0;
+	timer_handler = NULL;
+	timer_period_ns = 0;
+
+	memset(&sim_stats, 0, sizeof(sim_stats));
+
+	sim_sreg_i = 1;
+}
+
+void sim_attach(sim_slave_t* slave) {
+
+	sim_attach_bus(0, slave);
+}
+
+void sim_attach_bus(uint8_t bus, sim_slave_t* slave) {
+
+	slave->next = twis[bus].slaves;
+	twis[bus].slaves = slave;
+}
+
+void sim_timer(void (*handler)(void), uint32_t period_us) {
+
+	timer_handler = handler;
+	timer_period_ns = period_us * 1000;
+	timer_due_ns = now_ns + timer_period_ns;
+}
+
+uint8_t sim_host_transfer(uint8_t address, const uint8_t* tx, uint16_t tx_len, uint8_t* rx, uint16_t rx_len) {
+
+	sim_twi_t* twi = &twis[0];
+
+	sim_process(twi);
+
+	if (twi->state != BUS_IDLE || (twi->twcr & (1 << TWINT)) || !(twi->twcr & (1 << TWEN)) || !(twi->twcr & (1 << TWEA)) || (sim_twar[0] >> 1) != address) {
+		return 0;
+	}
+
+	twi->host_tx = tx;
+	twi->host_tx_len = tx_len;
+	twi->host_rx = rx;
+	twi->host_rx_len = rx_len;
+
+	sim_bus_time(twi, 10);
+	sim_host_begin(twi, 0);
+
+	return 1;
+}
+
+void sim_host_preempt(uint8_t address, const uint8_t* tx, uint16_t tx_len, uint8_t* rx, uint16_t rx_len) {
+
+	sim_twi_t* twi = &twis[0];
+
+	twi->host_address = address;
+	twi->host_tx = tx;
+	twi->host_tx_len = tx_len;
+	twi->host_rx = rx;
+	twi->host_rx_len = rx_len;
+	twi->host_wins = 1;
+}
+
+void sim_lose_arbitration(uint8_t count) {
+
+	twis[0].lose_arbitration = count;
+}
+
+void sim_rival_us(uint32_t us) {
+
+	twis[0].rival_us = us;
+}
+
+void sim_rival_transfer(uint32_t us) {
+
+	sim_twi_t* twi = &twis[0];
+
+	sim_process(twi);
+
+	if (twi->state == BUS_IDLE) {
+		sim_rival_begin(twi, (uint64_t)us * 1000);
+	}
+}
+
+/* Earliest STOP of a rival master still owning a bus, 0 if there is none */
+static uint64_t sim_rival_due(void) {
+
+	uint64_t due = 0;
+
+	for (uint8_t n = 0; n < SIM_TWI_BUSES; n++) {
+		if (twis[n].state == BUS_RIVAL && (due == 0 || twis[n].rival_until < due)) {
+			due = twis[n].rival_until;
+		}
+	}
+
+	return due;
+}
+
+/* Interrupt vector of TWI n */
+static void sim_vector(uint8_t n) {
+
+#if SIM_TWI_BUSES > 1
+	if (n != 0) {
+		TWI1_vect();
+	} else {
+		TWI0_vect();
+	}
+#else
+	TWI_vect();
+#endif
+}
+
+uint32_t sim_run(void) {
+
+	const uint8_t pending = (1 << TWINT) | (1 << TWIE) | (1 << TWEN);
+	uint32_t calls = 0;
+	uint8_t served;
+
+	do {
+		served = 0;
+
+		for (uint8_t n = 0; n < SIM_TWI_BUSES; n++) {
+			sim_process(&twis[n]);
+
+			if (!sim_sreg_i || (twis[n].twcr & pending) != pending) {
+				continue;
+			}
+
+			if (++calls > SIM_MAX_ISR_CALLS) {
+				fprintf(stderr, "sim: TWINT never cleared by the TWI ISR\n");
+				abort();
+			}
+
+			sim_sreg_i = 0;
+			sim_stats.isr_calls++;
+			sim_vector(n);
+			sim_sreg_i = 1;
+			served = 1;
+		}
+	} while (served);
+
+	return calls;
+}
+
+static void sim_fire_timer(void) {
+
+	now_ns = timer_due_ns;
+	timer_due_ns += timer_period_ns;
+
+	sim_sreg_i = 0;
+	timer_handler();
+	sim_sreg_i = 1;
+
+	sim_run();
+}
+
+void sim_sleep(void) {
+
+	uint64_t rival;
+
+	if (sim_run() != 0) {
+		return;
+	}
+
+	rival = sim_rival_due();
+
+	if (rival != 0 && (timer_handler == NULL || rival < timer_due_ns)) {
+		// The rival's STOP comes first, a waiting START goes out
+		now_ns = rival > now_ns ? rival : now_ns;
+		sim_run();
+		return;
+	}
+
+	if (timer_handler == NULL) {
+		fprintf(stderr, "sim: sleeping without pending interrupt or timer\n");
+		abort();
+	}
+
+	sim_fire_timer();
+}
+
+void sim_advance_us(uint32_t us) {
+
+	uint64_t until = now_ns + (uint64_t)us * 1000;
+
+	uint64_t rival;
+
+	sim_run();
+
+	for (;;) {
+		rival = sim_rival_due();
+
+		if (rival != 0 && rival <= until && (timer_handler == NULL || rival < timer_due_ns)) {
+			now_ns = rival > now_ns ? rival : now_ns;
+			sim_run();
+		} else if (timer_handler != NULL && timer_due_ns <= until) {
+			sim_fire_timer();
+		} else {
+			break;
+		}
+	}
+
+	if (now_ns < until) {
+		now_ns = until;
+	}
+}
+
+uint64_t sim_time_ns(void) {
+
+	return now_ns;
+}
@@ -0,0 +1,121 @@
+/*************************************************************************
+* Title		: sim_twi.h
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI
+* License	: MIT License
+* Usage		: see Doxygen manual
+*
+*       Copyright (C) 2026 Dimitri Dening
+*
+*       Permission is hereby granted, free of charge, to any person obtaining a copy
+*       of this software and associated documentation files (the "Software"), to deal
+*       in the Software without restriction, including without limitation the rights
+*       to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*       copies of the Software, and to permit persons to whom the Software is
+*       furnished to do so, subject to the following conditions:
+*
+*       The above copyright notice and this permission notice shall be included in all
+*       copies or substantial portions of the Software.
+*
+*       THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*       IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*       FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*       AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*       LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*       OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*       SOFTWARE.
+*
+*************************************************************************/
+
+/**
+@file sim_twi.h
+@author Dimitri Dening
+@date 17.10.2026
+@copyright (C) 2026 Dimitri Dening, MIT License
+@brief Host simulation of the AVR TWI peripheral.
+
+Provides the TWI register file and a bus with scriptable virtual slaves, so
+i2c.c runs unmodified on the host. Commands written to TWCR are executed on
+the next register access. sim_run() plays the role of the interrupt
+controller and calls the TWI ISR while TWINT is set. Bus time is derived
+from TWBR/TWSR and F_CPU. The ATmega328PB build simulates both TWIs, each
+with its own slaves.
+*/
+#ifndef SIM_TWI_H_
+#define SIM_TWI_H_
+
+#include <stdint.h>
+
+/* Virtual slave with a register map. The first byte of a write selects the register. */
+typedef struct sim_slave_t {
+	uint8_t address;          // 7-bit address
+	uint8_t regs[256];
+	uint8_t pointer;          // Auto-incrementing register pointer
+	uint8_t nack_address;     // NACK the next n address phases
+	uint8_t nack_data_at;     // NACK the n-th byte of a write (1 = register byte, 0 = never)
+	uint8_t hold_bus;         // Hang the next bus operation and keep SDA low
+	uint8_t stuck_clocks;     // SCL clocks needed to release SDA while hanging
+	uint16_t addressed;       // ACKed address phases
+	uint16_t written;         // Data bytes received, register byte included
+	uint16_t read;            // Data bytes sent
+	struct sim_slave_t* next;
+} sim_slave_t;
+
+typedef struct sim_stats_t {
+	uint32_t starts;
+	uint32_t repeated_starts;
+	uint32_t stops;
+	uint32_t isr_calls;
+	uint32_t recoveries;      // SDA released by SCL clocking
+	uint32_t arbitration_losses;
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+/* Clears bus, slaves, timer and statistics */
+void sim_reset(void);
+
+void sim_attach(sim_slave_t* slave);
+
+/* Attaches the slave to TWI bus (0..SIM_TWI_BUSES-1) */
+void sim_attach_bus(uint8_t bus, sim_slave_t* slave);
+
+/* Periodic timer interrupt, e.g. calling i2c_tick() */
+void sim_timer(void (*handler)(void), uint32_t period_us);
+
+/*
+ * An external master addresses our TWI 0: writes tx, then reads rx_len bytes after
+ * a repeated START (tx_len 0: read only). Proceeds in sim_run(). Returns 0 if the
+ * bus is busy or the address is not answered.
+ */
+uint8_t sim_host_transfer(uint8_t address, const uint8_t* tx, uint16_t tx_len, uint8_t* rx, uint16_t rx_len);
+
+/*
+ * Like sim_host_transfer(), but the external master wins arbitration against the
+ * next address phase of our TWI 0 instead of waiting for an idle bus.
+ */
+void sim_host_preempt(uint8_t address, const uint8_t* tx, uint16_t tx_len, uint8_t* rx, uint16_t rx_len);
+
+/* The next count address phases of TWI 0 lose arbitration to a master talking to another slave */
+void sim_lose_arbitration(uint8_t count);
+
+/* Bus time of the rival master of sim_lose_arbitration(), 0: SIM_RIVAL_BITS bit times */
+void sim_rival_us(uint32_t us);
+
+/* A master talking to another slave owns the bus of TWI 0 for us, a START waits for its STOP */
+void sim_rival_transfer(uint32_t us);
+
+/* Serves TWI interrupts of all buses until none is pending. Returns the number of ISR calls. */
+uint32_t sim_run(void);
+
+/* Idle sleep: serves pending TWI interrupts, otherwise fires the next timer interrupt */
+void sim_sleep(void);
+
+/* Advances the simulated time, firing timer interrupts on the way */
+void sim_advance_us(uint32_t us);
+
+uint64_t sim_time_ns(void);
+
+#endif /* SIM_TWI_H_ */
@@ -0,0 +1,1292 @@
+/*************************************************************************
+* Title		: I2C Host Test
+* Author	: Dimitri Dening
+* Created	: 17.10.2026
+* Software	: GCC (host)
+* Hardware	: Simulated TWI, see sim_twi.h
+* License	: MIT License
+* Usage		: make -C test_i2c/host test
+*
+*       Copyright (C) 2026 Dimitri Dening
+*
+*       Permission is hereby granted, free of charge, to any person obtaining a copy
+*       of this software and associated documentation files (the "Software"), to deal
+*       in the Software without restriction, including without limitation the rights
+*       to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*       copies of the Software, and to permit persons to whom the Software is
+*       furnished to do so, subject to the following conditions:
+*
+*       The above copyright notice and this permission notice shall be included in all
+*       copies or substantial portions of the Software.
+*
+*       THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*       IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*       FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*       AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*       LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*       OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*       SOFTWARE.
+*
+*************************************************************************/
+
+/* General libraries */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+/* User defined libraries */
+#include "suite.h"
+#include "i2c.h"
+#include "sim_twi.h"
+
+#define I2C_DEVICE_ADDR  0x27
+#define I2C_MISSING_ADDR 0x50
+#define I2C_SECOND_ADDR  0x3C
+
+#define TICK_PERIOD_US   1000
+
+static sim_slave_t slave;
+static device_t* i2c_device;
+static device_t* missing_device;
+
+static uint8_t dummy_payload[] = { 0x10, 1, 2, 3, 4 }; // Register, data
+
+/* Fresh simulator, driver and slave for every test */
+static void host_setup(i2c_config_t* config) {
+
+	i2c_config_t default_config = I2C_DEFAULT_CONFIG;
+
+	sim_reset();
+
+	memset(&slave, 0, sizeof(slave));
+	slave.address = I2C_DEVICE_ADDR;
+	sim_attach(&slave);
+
+	sim_timer(i2c_tick, TICK_PERIOD_US);
+
+	i2c_init(config != NULL ? config : &default_config);
+}
+
+static int run_i2c_write_test(const struct test_case* test) {
+
+	host_setup(NULL);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	if (i2c_write(payload) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	// Nothing happens on the bus until the simulator serves the interrupt
+	if (i2c_poll(handle) != I2C_ERROR_BUSY) {
+		return TEST_FAIL;
+	}
+
+	sim_run();
+
+	uint16_t transferred = i2c_payload_transferred(payload);
+
+	if (i2c_poll(handle) != I2C_NO_ERROR || transferred != ARRAY_LEN(dummy_payload)) {
+		return TEST_FAIL;
+	}
+
+	if (memcmp(&slave.regs[0x10], &dummy_payload[1], ARRAY_LEN(dummy_payload) - 1) != 0 ||
+		sim_stats.starts != 1 || sim_stats.stops != 1) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_write_read_test(const struct test_case* test) {
+
+	uint8_t reg = 0x20;
+	uint8_t rx[4] = { 0 };
+	static const uint8_t expected[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+
+	host_setup(NULL);
+
+	memcpy(&slave.regs[0x20], expected, sizeof(expected));
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, &reg, 1, NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write_read(payload, rx, sizeof(rx));
+
+	if (i2c_wait(handle) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	if (memcmp(rx, expected, sizeof(rx)) != 0 || sim_stats.starts != 1 ||
+		sim_stats.repeated_starts != 1 || sim_stats.stops != 1) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_segment_test(const struct test_case* test) {
+
+	uint8_t header[] = { 0x40 };
+	uint8_t page[] = { 9, 8, 7 };
+	uint8_t rx[3] = { 0 };
+
+	i2c_segment_t segments[] = {
+		{ header, sizeof(header), I2C_SEGMENT_WRITE },
+		{ page, sizeof(page), I2C_SEGMENT_WRITE | I2C_SEGMENT_NO_RESTART },
+		{ header, sizeof(header), I2C_SEGMENT_WRITE },
+		{ rx, sizeof(rx), I2C_SEGMENT_READ },
+	};
+
+	host_setup(NULL);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, NULL, 0, NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_transfer(payload, segments, ARRAY_LEN(segments));
+
+	if (i2c_wait(handle) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	if (memcmp(&slave.regs[0x40], page, sizeof(page)) != 0 || memcmp(rx, page, sizeof(page)) != 0 ||
+		sim_stats.starts != 1 || sim_stats.repeated_starts != 2 || sim_stats.stops != 1) {
+		return TEST_FAIL;
+	}
+
+	// Empty data or segments are refused, nothing reaches the bus
+	segments[1].number_of_bytes = 0;
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, NULL, 0, NULL);
+
+	if (i2c_transfer(payload, segments, ARRAY_LEN(segments)) != I2C_ERROR_INVALID_PAYLOAD) {
+		return TEST_FAIL;
+	}
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, NULL, 0, NULL);
+
+	if (i2c_write(payload) != I2C_ERROR_INVALID_PAYLOAD || sim_stats.starts != 1 || i2c_payload_high_water_mark() != 1) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_chain_test(const struct test_case* test) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+
+	config.chain_limit = 2;
+
+	host_setup(&config);
+
+	cli();
+
+	for (uint8_t i = 0; i < 4; i++) {
+		i2c_write(i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL));
+	}
+
+	sei();
+
+	sim_run();
+
+	// Four payloads, two chained by repeated START, then STOP/START
+	if (sim_stats.starts != 2 || sim_stats.repeated_starts != 2 || sim_stats.stops != 2 || slave.addressed != 4) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_ring_test(const struct test_case* test) {
+
+	i2c_handle_t handles[I2C_PAYLOAD_POOL_SIZE];
+	i2c_stats_t stats;
+
+	host_setup(NULL);
+
+	// Interrupts stay enabled, the bus only picks its payload once the START is done
+	for (uint8_t i = 0; i < I2C_PAYLOAD_POOL_SIZE; i++) {
+		payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+
+		handles[i] = i2c_track(payload);
+
+		if (i2c_write(payload) != I2C_NO_ERROR) {
+			return TEST_FAIL;
+		}
+	}
+
+	i2c_stats_snapshot(&stats);
+
+	if (stats.queue_depth != I2C_PAYLOAD_POOL_SIZE) {
+		return TEST_FAIL;
+	}
+
+	for (uint8_t i = 0; i < I2C_PAYLOAD_POOL_SIZE; i++) {
+		if (i2c_wait(handles[i]) != I2C_NO_ERROR) {
+			return TEST_FAIL;
+		}
+	}
+
+	i2c_stats_snapshot(&stats);
+
+	if (stats.queue_depth != 0 || slave.addressed != I2C_PAYLOAD_POOL_SIZE || i2c_payload_high_water_mark() != I2C_PAYLOAD_POOL_SIZE) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static uint8_t order[I2C_PAYLOAD_POOL_SIZE];
+static uint8_t completed;
+
+static void record_order(void* _payload) {
+
+	order[completed++] = ((payload_t*)_payload)->priority;
+}
+
+/* Queues the priorities while the bus is held, then returns the completion order */
+static uint8_t* run_scheduler(uint8_t scheduler, uint8_t aging, const uint8_t* priorities, uint8_t n) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+
+	config.scheduler = scheduler;
+	config.aging = aging;
+
+	host_setup(&config);
+
+	completed = 0;
+
+	cli();
+
+	for (uint8_t i = 0; i < n; i++) {
+		i2c_write(i2c_payload_create((priority_t)priorities[i], i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), record_order));
+	}
+
+	sei();
+
+	sim_run();
+
+	return order;
+}
+
+static int run_i2c_scheduler_test(const struct test_case* test) {
+
+	static const uint8_t queued[]    = { PRIORITY_LOW, PRIORITY_LOW, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH };
+	static const uint8_t strict[]    = { PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_LOW, PRIORITY_LOW };
+	static const uint8_t aged[]      = { PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_LOW, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_LOW };
+	static const uint8_t bulk[]      = { PRIORITY_LOW, PRIORITY_LOW, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH };
+	static const uint8_t wrr[]       = { PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_LOW, PRIORITY_HIGH, PRIORITY_LOW };
+
+	if (memcmp(run_scheduler(I2C_SCHED_STRICT, 0, queued, ARRAY_LEN(queued)), strict, ARRAY_LEN(strict)) != 0) {
+		return TEST_FAIL;
+	}
+
+	// Low priority is served after being passed over twice
+	if (memcmp(run_scheduler(I2C_SCHED_STRICT, 2, queued, ARRAY_LEN(queued)), aged, ARRAY_LEN(aged)) != 0) {
+		return TEST_FAIL;
+	}
+
+	// High gets 4 picks per round, low 1
+	if (memcmp(run_scheduler(I2C_SCHED_WRR, 0, bulk, ARRAY_LEN(bulk)), wrr, ARRAY_LEN(wrr)) != 0) {
+		return TEST_FAIL;
+	}
+
+	// FIFO keeps the submission order
+	if (memcmp(run_scheduler(I2C_SCHED_FIFO, 0, queued, ARRAY_LEN(queued)), queued, ARRAY_LEN(queued)) != 0) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_nack_test(const struct test_case* test) {
+
+	host_setup(NULL);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, missing_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_ERROR_ADDR_NACK) {
+		return TEST_FAIL;
+	}
+
+	slave.nack_data_at = 2;
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_ERROR_DATA_NACK) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_retry_test(const struct test_case* test) {
+
+	host_setup(NULL);
+
+	// EEPROM busy with its write cycle for three address phases
+	slave.nack_address = 3;
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_payload_set_retry(payload, 5, 0, I2C_RETRY_ACK_POLLING);
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || slave.addressed != 1) {
+		return TEST_FAIL;
+	}
+
+	// Delayed retries are parked until i2c_tick() requeues them, 3 then 6 ticks.
+	// The first tick of each delay may come right after parking.
+	slave.nack_address = 2;
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	handle = i2c_track(payload);
+
+	i2c_payload_set_retry(payload, 2, 3, I2C_RETRY_EXPONENTIAL);
+	i2c_write(payload);
+
+	uint64_t start = sim_time_ns();
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || sim_time_ns() - start < (2 + 5) * TICK_PERIOD_US * 1000ULL) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static i2c_periodic_t callback_job;
+static uint8_t callback_sample;
+static uint8_t callback_calls;
+
+/* Reads the job from its own callback, must see the sample just taken */
+static void host_periodic_callback(void* payload) {
+
+	i2c_periodic_read(callback_job, &callback_sample);
+	callback_calls++;
+}
+
+/* Sample seen by the job callback after the next sample of register 0x30 with the given value */
+static uint8_t host_periodic_callback_sample(uint8_t value, uint32_t ticks) {
+
+	slave.regs[0x30] = value;
+	sim_advance_us(ticks * TICK_PERIOD_US);
+	i2c_process_completions();
+
+	return callback_sample;
+}
+
+static int run_i2c_periodic_test(const struct test_case* test) {
+
+	uint8_t buffer[2 * 2];
+	uint8_t sample[2];
+
+	host_setup(NULL);
+
+	slave.regs[0x20] = 0x12;
+	slave.regs[0x21] = 0x34;
+
+	i2c_periodic_t job = i2c_periodic_create(i2c_device, 0x20, buffer, 2, 5, NULL);
+
+	if (job == NULL || i2c_periodic_read(job, sample) != I2C_ERROR_BUSY) {
+		return TEST_FAIL;
+	}
+
+	// Samples at ticks 1, 6, 11, 16
+	sim_advance_us(18 * TICK_PERIOD_US);
+
+	if (i2c_periodic_read(job, sample) != I2C_NO_ERROR || sample[0] != 0x12 || sample[1] != 0x34 || slave.addressed != 2 * 4) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_periodic_overruns(job) != 0 || i2c_payload_high_water_mark() != 1) {
+		return TEST_FAIL;
+	}
+
+	// The sample at tick 21 hangs, ticks 26 and 31 overrun
+	slave.hold_bus = 1;
+	slave.stuck_clocks = 1;
+
+	sim_advance_us(15 * TICK_PERIOD_US);
+
+	if (i2c_periodic_overruns(job) != 2 || i2c_periodic_read(job, sample) != I2C_NO_ERROR || sample[0] != 0x12) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_periodic_stop(job) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	// The callback reads the sample it is called for, directly and deferred
+	for (uint8_t deferred = 0; deferred < 2; deferred++) {
+		i2c_config_t config = I2C_DEFAULT_CONFIG;
+		uint8_t samples[2];
+
+		config.deferred = deferred;
+		host_setup(&config);
+
+		callback_calls = 0;
+		callback_job = i2c_periodic_create(i2c_device, 0x30, samples, 1, 5, host_periodic_callback);
+
+		if (host_periodic_callback_sample(0x11, 2) != 0x11 || host_periodic_callback_sample(0x22, 5) != 0x22 || callback_calls != 2) {
+			return TEST_FAIL;
+		}
+
+		i2c_periodic_stop(callback_job);
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_polled_test(const struct test_case* test) {
+
+	uint8_t reg = 0x10;
+	uint8_t rx[4] = { 0 };
+
+	host_setup(NULL);
+
+	if (i2c_write_polled(i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL)) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_write_read_polled(i2c_payload_create(PRIORITY_NORMAL, i2c_device, &reg, 1, NULL), rx, ARRAY_LEN(rx)) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	if (memcmp(rx, &dummy_payload[1], ARRAY_LEN(rx)) != 0 || sim_stats.isr_calls != 0) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_write_polled(i2c_payload_create(PRIORITY_NORMAL, missing_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL)) != I2C_ERROR_ADDR_NACK) {
+		return TEST_FAIL;
+	}
+
+	// Bus busy with a queued transfer, the polled write is queued behind it
+	i2c_write(i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL));
+
+	if (i2c_write_polled(i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL)) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	return (sim_stats.isr_calls != 0 && slave.addressed == 5) ? TEST_PASS : TEST_FAIL;
+}
+
+static const uint8_t init_table[] PROGMEM = {
+	I2C_TABLE_REG(I2C_DEVICE_ADDR, 0x01, 0xAA),
+	I2C_TABLE_WRITE(I2C_DEVICE_ADDR, 3, 3, 0x02, 0xBB, 0xCC),
+	I2C_TABLE_REG(I2C_SECOND_ADDR, 0x05, 0x55),
+	I2C_TABLE_END
+};
+
+static int run_i2c_table_test(const struct test_case* test) {
+
+	sim_slave_t second = { .address = I2C_SECOND_ADDR };
+
+	host_setup(NULL);
+	sim_attach(&second);
+
+	i2c_device_stats_t table_stats;
+	device_t* table_device = i2c_create_device(0); // Bus, speed and statistics, the records address themselves
+
+	payload_t* payload = i2c_payload_create_table(PRIORITY_NORMAL, table_device, init_table, NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	uint64_t start = sim_time_ns();
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || i2c_payload_high_water_mark() != 1) {
+		return TEST_FAIL;
+	}
+
+	if (slave.regs[0x01] != 0xAA || slave.regs[0x02] != 0xBB || slave.regs[0x03] != 0xCC || second.regs[0x05] != 0x55) {
+		return TEST_FAIL;
+	}
+
+	// First two records share the bus, the delay releases it for 3 ticks
+	if (sim_stats.repeated_starts != 1 || sim_stats.starts != 2 || sim_time_ns() - start < 2 * TICK_PERIOD_US * 1000ULL) {
+		return TEST_FAIL;
+	}
+
+	i2c_device_stats(table_device, &table_stats);
+	i2c_free_device(table_device);
+
+	if (table_stats.completed != 1) {
+		return TEST_FAIL;
+	}
+
+	// The second record has no data, the ISR would run past the table
+	static const uint8_t empty_record[] PROGMEM = { I2C_DEVICE_ADDR, 2, 0x10, 1, 0, I2C_DEVICE_ADDR, 0, 0, I2C_TABLE_END };
+	static const uint8_t empty_table[] PROGMEM = { I2C_TABLE_END };
+
+	if (i2c_payload_create_table(PRIORITY_NORMAL, i2c_device, empty_record, NULL) != NULL || i2c_payload_create_table(PRIORITY_NORMAL, i2c_device, empty_table, NULL) != NULL) {
+		return TEST_FAIL;
+	}
+
+	return i2c_payload_high_water_mark() == 1 ? TEST_PASS : TEST_FAIL;
+}
+
+static const uint8_t flash_block[] PROGMEM = { 0x40, 0xF0, 0xF1, 0xF2, 0xF3 };
+
+static int run_i2c_flash_test(const struct test_case* test) {
+
+	uint8_t header[] = { 0x50 };
+	i2c_segment_t segments[] = {
+		{ header, ARRAY_LEN(header), I2C_SEGMENT_WRITE },
+		{ (uint8_t*)&flash_block[1], 4, I2C_SEGMENT_WRITE | I2C_SEGMENT_NO_RESTART | I2C_SEGMENT_FLASH },
+	};
+
+	host_setup(NULL);
+
+	payload_t* payload = i2c_payload_create_P(PRIORITY_NORMAL, i2c_device, flash_block, ARRAY_LEN(flash_block), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || memcmp(&slave.regs[0x40], &flash_block[1], 4) != 0) {
+		return TEST_FAIL;
+	}
+
+	payload = i2c_payload_create_far(PRIORITY_NORMAL, i2c_device, pgm_get_far_address(flash_block), ARRAY_LEN(flash_block), NULL);
+	handle = i2c_track(payload);
+
+	memset(&slave.regs[0x40], 0, 4);
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || memcmp(&slave.regs[0x40], &flash_block[1], 4) != 0) {
+		return TEST_FAIL;
+	}
+
+	// RAM register byte, flash data
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, NULL, 0, NULL);
+	handle = i2c_track(payload);
+
+	i2c_transfer(payload, segments, ARRAY_LEN(segments));
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || memcmp(&slave.regs[0x50], &flash_block[1], 4) != 0) {
+		return TEST_FAIL;
+	}
+
+	// Flash cannot be read into
+	payload = i2c_payload_create_P(PRIORITY_NORMAL, i2c_device, flash_block, ARRAY_LEN(flash_block), NULL);
+
+	return i2c_read(payload) == I2C_ERROR_INVALID_PAYLOAD ? TEST_PASS : TEST_FAIL;
+}
+
+static uint8_t stream_buffers[2][100];
+static uint8_t stream_chunk;
+static uint16_t stream_sum;
+
+/* Double buffered: sums the finished chunk and hands out the other buffer */
+static uint16_t stream_hook(payload_t* payload, uint8_t** chunk) {
+
+	uint8_t* finished = stream_buffers[stream_chunk & 1];
+
+	for (uint8_t i = 0; i < ARRAY_LEN(stream_buffers[0]); i++) {
+		stream_sum += finished[i];
+	}
+
+	*chunk = stream_buffers[++stream_chunk & 1];
+
+	return ARRAY_LEN(stream_buffers[0]);
+}
+
+static int run_i2c_stream_test(const struct test_case* test) {
+
+	static uint8_t block[300];
+	uint8_t reg = 0x00;
+	uint16_t expected = 0;
+
+	host_setup(NULL);
+
+	// 16-bit length without streaming
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, block, ARRAY_LEN(block), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || slave.written != ARRAY_LEN(block)) {
+		return TEST_FAIL;
+	}
+
+	// Read 300 bytes through two 100 byte buffers
+	for (uint16_t i = 0; i < 256; i++) {
+		slave.regs[i] = (uint8_t)i;
+	}
+
+	for (uint16_t i = 0; i < 300; i++) {
+		expected += (uint8_t)i;
+	}
+
+	stream_chunk = 0;
+	stream_sum = 0;
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, &reg, 1, NULL);
+	handle = i2c_track(payload);
+
+	i2c_payload_set_stream(payload, stream_hook, 300);
+	i2c_write_read(payload, stream_buffers[0], ARRAY_LEN(stream_buffers[0]));
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || stream_sum != expected || stream_chunk != 3 || slave.read != 300) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static uint32_t marks[4];
+static uint8_t notifications;
+
+static void record_progress(void* _payload) {
+
+	if (notifications < ARRAY_LEN(marks)) {
+		marks[notifications] = i2c_payload_transferred(_payload);
+	}
+
+	notifications++;
+}
+
+static int run_i2c_watermark_test(const struct test_case* test) {
+
+	uint8_t rx[10] = { 0 };
+
+	host_setup(NULL);
+
+	for (uint8_t i = 0; i < ARRAY_LEN(rx); i++) {
+		slave.regs[i] = 0xA0 + i;
+	}
+
+	notifications = 0;
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, rx, ARRAY_LEN(rx), record_progress);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_payload_set_watermark(payload, 4);
+	i2c_read(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || notifications != 3) {
+		return TEST_FAIL;
+	}
+
+	// Two progress notifications, then completion with every byte stored
+	if (marks[0] != 4 || marks[1] != 8 || marks[2] != ARRAY_LEN(rx) || rx[0] != 0xA0 || rx[9] != 0xA9) {
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+static int run_i2c_stats_test(const struct test_case* test) {
+
+	i2c_stats_t stats;
+	i2c_device_stats_t before, after;
+
+	host_setup(NULL);
+
+	i2c_device_stats(i2c_device, &before);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+	i2c_wait(handle);
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, missing_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	handle = i2c_track(payload);
+
+	i2c_write(payload);
+	i2c_wait(handle);
+
+	i2c_stats_snapshot(&stats);
+	i2c_device_stats(i2c_device, &after);
+
+	if (stats.completed != 1 || stats.addr_nacks != 1 || stats.bytes != ARRAY_LEN(dummy_payload)) {
+		return TEST_FAIL;
+	}
+
+	if (stats.queue_depth != 0 || stats.max_queue_depth != 1 || after.completed != before.completed + 1) {
+		return TEST_FAIL;
+	}
+
+	uint16_t histogram = 0;
+
+	for (uint8_t i = 0; i < I2C_STATS_LATENCY_BUCKETS; i++) {
+		histogram += stats.latency[i];
+	}
+
+	if (histogram != 2) {
+		return TEST_FAIL;
+	}
+
+	i2c_stats_reset();
+	i2c_stats_snapshot(&stats);
+
+	return stats.completed == 0 ? TEST_PASS : TEST_FAIL;
+}
+
+static int run_i2c_watchdog_test(const struct test_case* test) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+
+	config.timeout = 5;
+
+	host_setup(&config);
+
+	slave.hold_bus = 1;
+	slave.stuck_clocks = 4;
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	// Queued behind the hung transfer, must survive the recovery
+	payload_t* queued = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t queued_handle = i2c_track(queued);
+
+	i2c_write(queued);
+
+	if (i2c_wait(handle) != I2C_ERROR_TIMEOUT || sim_stats.recoveries != 1) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_wait(queued_handle) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	// 9 clocks do not free SDA, the next START waits on a bus that never becomes free
+	host_setup(&config);
+
+	slave.hold_bus = 1;
+	slave.stuck_clocks = 12;
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	handle = i2c_track(payload);
+	i2c_write(payload);
+
+	queued = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	queued_handle = i2c_track(queued);
+	i2c_write(queued);
+
+	if (i2c_wait(handle) != I2C_ERROR_TIMEOUT || sim_stats.recoveries != 0) {
+		return TEST_FAIL;
+	}
+
+	// Still waiting before the longer limit, recovered after it
+	sim_advance_us((I2C_BUS_WAIT_FACTOR * 5 - 2) * TICK_PERIOD_US);
+
+	if (i2c_poll(queued_handle) != I2C_ERROR_BUSY || sim_stats.recoveries != 0) {
+		return TEST_FAIL;
+	}
+
+	sim_advance_us(4 * TICK_PERIOD_US);
+
+	return (i2c_poll(queued_handle) == I2C_NO_ERROR && sim_stats.recoveries == 1) ? TEST_PASS : TEST_FAIL;
+}
+
+/* Completion record, passed as callback context */
+typedef struct {
+	uint8_t calls;
+	i2c_error_t result;
+} completion_t;
+
+static void record_completion(void* context, i2c_error_t result) {
+
+	completion_t* completion = context;
+
+	completion->calls++;
+	completion->result = result;
+}
+
+static int run_i2c_completion_test(const struct test_case* test) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+	completion_t done = { 0 };
+	completion_t nacked = { 0 };
+
+	config.deferred = 1;
+
+	host_setup(&config);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_payload_set_callback(payload, record_completion, &done);
+	i2c_write(payload);
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, missing_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_payload_set_callback(payload, record_completion, &nacked);
+	i2c_write(payload);
+
+	sim_run();
+
+	// Nothing runs in the ISR, the main loop picks the completions up
+	if (done.calls != 0 || nacked.calls != 0) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_process_completions() != 2 || i2c_process_completions() != 0) {
+		return TEST_FAIL;
+	}
+
+	if (done.calls != 1 || done.result != I2C_NO_ERROR || nacked.calls != 1 || nacked.result != I2C_ERROR_ADDR_NACK) {
+		return TEST_FAIL;
+	}
+
+	// Both entries went back to the pool after their callbacks
+	payload_t* payloads[I2C_PAYLOAD_POOL_SIZE];
+
+	for (uint8_t i = 0; i < I2C_PAYLOAD_POOL_SIZE; i++) {
+		if ((payloads[i] = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, 1, NULL)) == NULL) {
+			return TEST_FAIL;
+		}
+	}
+
+	for (uint8_t i = 0; i < I2C_PAYLOAD_POOL_SIZE; i++) {
+		i2c_payload_free(payloads[i]);
+	}
+
+	// A tracked transfer runs its callback when polled
+	memset(&done, 0, sizeof(done));
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_payload_set_callback(payload, record_completion, &done);
+	i2c_handle_t handle = i2c_track(payload);
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || done.calls != 1 || i2c_process_completions() != 0) {
+		return TEST_FAIL;
+	}
+
+	// Without deferred mode the callback runs in the ISR
+	host_setup(NULL);
+	memset(&done, 0, sizeof(done));
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_payload_set_callback(payload, record_completion, &done);
+	i2c_write(payload);
+
+	sim_run();
+
+	return done.calls == 1 && done.result == I2C_NO_ERROR ? TEST_PASS : TEST_FAIL;
+}
+
+#define I2C_OWN_ADDR     0x42
+
+static uint8_t slave_reg;
+static uint16_t slave_count;
+
+static void record_slave_write(uint8_t reg, uint16_t count) {
+
+	slave_reg = reg;
+	slave_count += count;
+}
+
+static int run_i2c_slave_test(const struct test_case* test) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+	uint8_t regs[8] = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80 };
+	static const uint8_t write_mask[8] = { 0x00, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	i2c_register_map_t map = { I2C_OWN_ADDR, regs, write_mask, sizeof(regs), record_slave_write };
+
+	config.mode = I2C_MASTER_MODE | I2C_SLAVE_MODE;
+	config.slave = &map;
+
+	host_setup(&config);
+
+	slave_reg = 0;
+	slave_count = 0;
+
+	// Register 0 is read-only, register 1 takes the low nibble only
+	static const uint8_t write[] = { 0x00, 0xAA, 0xBB, 0xCC };
+
+	if (!sim_host_transfer(I2C_OWN_ADDR, write, sizeof(write), NULL, 0)) {
+		return TEST_FAIL;
+	}
+
+	sim_run();
+
+	if (regs[0] != 0x10 || regs[1] != 0x2B || regs[2] != 0xCC || slave_reg != 0 || slave_count != 3) {
+		return TEST_FAIL;
+	}
+
+	// Register read with repeated START, past the end of the map
+	static const uint8_t select[] = { 0x06 };
+	uint8_t rx[4] = { 0 };
+
+	sim_host_transfer(I2C_OWN_ADDR, select, sizeof(select), rx, sizeof(rx));
+	sim_run();
+
+	if (rx[0] != 0x70 || rx[1] != 0x80 || rx[2] != 0xFF || rx[3] != 0xFF || slave_count != 3) {
+		return TEST_FAIL;
+	}
+
+	// The pointer keeps auto-incrementing across reads
+	sim_host_transfer(I2C_OWN_ADDR, write, 1, NULL, 0);
+	sim_run();
+	sim_host_transfer(I2C_OWN_ADDR, NULL, 0, rx, 2);
+	sim_run();
+
+	if (rx[0] != 0x10 || rx[1] != 0x2B) {
+		return TEST_FAIL;
+	}
+
+	// A payload submitted while addressed waits for the STOP
+	sim_host_transfer(I2C_OWN_ADDR, select, sizeof(select), rx, 1);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || rx[0] != 0x70 || sim_stats.starts != 1) {
+		return TEST_FAIL;
+	}
+
+	if (memcmp(&slave.regs[0x10], &dummy_payload[1], ARRAY_LEN(dummy_payload) - 1) != 0) {
+		return TEST_FAIL;
+	}
+
+	// Still answering after being master
+	if (!sim_host_transfer(I2C_OWN_ADDR, NULL, 0, rx, 1) || sim_run() == 0) {
+		return TEST_FAIL;
+	}
+
+	// Maps past 256 bytes: the pointer runs on to the end instead of wrapping to 0
+	static uint8_t large[258];
+	static const uint8_t tail[] = { 0xFE, 0x01, 0x02, 0x03, 0x04, 0x05 };
+	i2c_register_map_t large_map = { I2C_OWN_ADDR, large, NULL, sizeof(large), NULL };
+
+	config.slave = &large_map;
+
+	host_setup(&config);
+	memset(large, 0, sizeof(large));
+
+	sim_host_transfer(I2C_OWN_ADDR, tail, sizeof(tail), NULL, 0);
+	sim_run();
+
+	if (large[0] != 0 || large[0xFE] != 0x01 || large[0x101] != 0x04) {
+		return TEST_FAIL;
+	}
+
+	sim_host_transfer(I2C_OWN_ADDR, tail, 1, rx, 4);
+	sim_run();
+
+	return (rx[2] == 0x03 && rx[3] == 0x04 && large[0] == 0) ? TEST_PASS : TEST_FAIL;
+}
+
+static int run_i2c_arbitration_test(const struct test_case* test) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+	i2c_stats_t stats;
+
+	host_setup(NULL);
+
+	// A rival master wins the next two address phases, the payload is resumed
+	sim_lose_arbitration(2);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || memcmp(&slave.regs[0x10], &dummy_payload[1], ARRAY_LEN(dummy_payload) - 1) != 0) {
+		return TEST_FAIL;
+	}
+
+	i2c_stats_snapshot(&stats);
+
+	// No STOP on a bus owned by the other master
+	if (sim_stats.starts != 3 || sim_stats.stops != 1 || stats.arb_lost != 2 || stats.completed != 1) {
+		return TEST_FAIL;
+	}
+
+	sim_lose_arbitration(I2C_ARB_LOST_RETRIES + 1);
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_ERROR_ARB_LOST) {
+		return TEST_FAIL;
+	}
+
+	// The winner addresses us, the payload follows its STOP
+	uint8_t regs[4] = { 0 };
+	i2c_register_map_t map = { I2C_OWN_ADDR, regs, NULL, sizeof(regs), NULL };
+	static const uint8_t write[] = { 0x01, 0xA5 };
+
+	config.mode = I2C_MASTER_MODE | I2C_SLAVE_MODE;
+	config.slave = &map;
+
+	host_setup(&config);
+	memset(slave.regs, 0, sizeof(slave.regs));
+
+	sim_host_preempt(I2C_OWN_ADDR, write, sizeof(write), NULL, 0);
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || regs[1] != 0xA5 || sim_stats.arbitration_losses != 1 || sim_stats.starts != 2) {
+		return TEST_FAIL;
+	}
+
+	return memcmp(&slave.regs[0x10], &dummy_payload[1], ARRAY_LEN(dummy_payload) - 1) == 0 ? TEST_PASS : TEST_FAIL;
+}
+
+static int run_i2c_arbitration_wait_test(const struct test_case* test) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+	i2c_stats_t stats;
+
+	config.timeout = 2;
+
+	host_setup(&config);
+
+	// The winner keeps the bus for 10 ticks, the START waits without the watchdog
+	sim_lose_arbitration(1);
+	sim_rival_us(10 * TICK_PERIOD_US);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || sim_time_ns() < 10ULL * TICK_PERIOD_US * 1000) {
+		return TEST_FAIL;
+	}
+
+	// Same for a START queued while another master talks
+	sim_rival_transfer(10 * TICK_PERIOD_US);
+
+	payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	i2c_stats_snapshot(&stats);
+
+	if (stats.timeouts != 0 || stats.completed != 2 || sim_stats.starts != 3 || sim_stats.stops != 2) {
+		return TEST_FAIL;
+	}
+
+	return memcmp(&slave.regs[0x10], &dummy_payload[1], ARRAY_LEN(dummy_payload) - 1) == 0 ? TEST_PASS : TEST_FAIL;
+}
+
+/* Bus time of a write to the device, 0 on failure */
+static uint64_t host_write_time(device_t* device) {
+
+	uint64_t start = sim_time_ns();
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR) {
+		return 0;
+	}
+
+	return sim_time_ns() - start;
+}
+
+static int run_i2c_device_speed_test(const struct test_case* test) {
+
+	host_setup(NULL);
+
+	device_t* fast = i2c_create_device(I2C_DEVICE_ADDR);
+
+	// Slower than the bus would get its START at the bus speed
+	if (i2c_device_set_speed(fast, I2C_STANDARD_MODE / 2) != I2C_ERROR_INVALID_SPEED || i2c_device_frequency(fast) != 100000) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_device_set_speed(fast, I2C_FAST_MODE) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+
+	uint64_t standard = host_write_time(i2c_device);
+	uint64_t quick = host_write_time(fast);
+	uint64_t restored = host_write_time(i2c_device);
+
+	i2c_free_device(fast);
+
+	// 400 kHz next to the 100 kHz bus speed, which is restored afterwards
+	return (quick != 0 && 3 * quick < standard && restored == standard) ? TEST_PASS : TEST_FAIL;
+}
+
+static int run_i2c_frequency_test(const struct test_case* test) {
+
+	int16_t error = -1;
+
+	host_setup(NULL);
+
+	device_t* fast = i2c_create_device(I2C_DEVICE_ADDR);
+
+	i2c_device_set_speed(fast, I2C_FAST_MODE);
+
+	// 10 MHz: exact at 100 kHz, 400 kHz rounded down to 384.6 kHz
+	if (i2c_bus_frequency(0, &error) != 100000 || error != 0 || i2c_bus_frequency(I2C_BUSES, NULL) != 0) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_device_frequency(fast) != 384615 || i2c_device_frequency(i2c_device) != 100000) {
+		return TEST_FAIL;
+	}
+
+	i2c_free_device(fast);
+
+#if !defined(I2C_SCL_FREQUENCY)
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+
+	// Out of reach at 10 MHz, runs at F_CPU / 16 and says so
+	config.scl_target_frequency = I2C_HIGH_SPEED;
+
+	host_setup(&config);
+
+	if (i2c_bus_frequency(0, &error) != 625000 || error != -817) {
+		return TEST_FAIL;
+	}
+#endif
+
+	return TEST_PASS;
+}
+
+#if I2C_BUSES > 1
+static int run_i2c_dual_bus_test(const struct test_case* test) {
+
+	i2c_config_t config = I2C_DEFAULT_CONFIG;
+	sim_slave_t other = { .address = I2C_DEVICE_ADDR }; // Same address, other bus
+
+	config.timeout = 5;
+
+	host_setup(&config);
+	sim_attach_bus(1, &other);
+
+	config.bus = 1;
+
+	if (i2c_init(&config) != I2C_NO_ERROR || i2c_create_bus_device(I2C_BUSES, I2C_DEVICE_ADDR) != NULL) {
+		return TEST_FAIL;
+	}
+
+	device_t* device = i2c_create_bus_device(1, I2C_DEVICE_ADDR);
+
+	// Bus 0 hangs until the watchdog recovers it, bus 1 keeps going meanwhile
+	slave.hold_bus = 1;
+	slave.stuck_clocks = 4;
+
+	payload_t* hung = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t hung_handle = i2c_track(hung);
+
+	i2c_write(hung);
+
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	i2c_handle_t handle = i2c_track(payload);
+
+	i2c_write(payload);
+
+	if (i2c_wait(handle) != I2C_NO_ERROR || i2c_poll(hung_handle) != I2C_ERROR_BUSY) {
+		return TEST_FAIL;
+	}
+
+	if (memcmp(&other.regs[0x10], &dummy_payload[1], ARRAY_LEN(dummy_payload) - 1) != 0 || slave.written != 0) {
+		return TEST_FAIL;
+	}
+
+	if (i2c_wait(hung_handle) != I2C_ERROR_TIMEOUT || sim_stats.recoveries != 1) {
+		return TEST_FAIL;
+	}
+
+	i2c_free_device(device);
+
+	return TEST_PASS;
+}
+#endif
+
+int main(void) {
+
+	i2c_device = i2c_create_device(I2C_DEVICE_ADDR);
+	missing_device = i2c_create_device(I2C_MISSING_ADDR);
+
+	DEFINE_TEST_CASE(i2c_write_test, NULL, run_i2c_write_test, NULL, "I2C write test");
+	DEFINE_TEST_CASE(i2c_write_read_test, NULL, run_i2c_write_read_test, NULL, "I2C write/read test");
+	DEFINE_TEST_CASE(i2c_segment_test, NULL, run_i2c_segment_test, NULL, "I2C segment test");
+	DEFINE_TEST_CASE(i2c_chain_test, NULL, run_i2c_chain_test, NULL, "I2C chain test");
+	DEFINE_TEST_CASE(i2c_ring_test, NULL, run_i2c_ring_test, NULL, "I2C submission ring test");
+	DEFINE_TEST_CASE(i2c_scheduler_test, NULL, run_i2c_scheduler_test, NULL, "I2C scheduler test");
+	DEFINE_TEST_CASE(i2c_nack_test, NULL, run_i2c_nack_test, NULL, "I2C NACK test");
+	DEFINE_TEST_CASE(i2c_retry_test, NULL, run_i2c_retry_test, NULL, "I2C retry test");
+	DEFINE_TEST_CASE(i2c_watchdog_test, NULL, run_i2c_watchdog_test, NULL, "I2C watchdog test");
+	DEFINE_TEST_CASE(i2c_periodic_test, NULL, run_i2c_periodic_test, NULL, "I2C periodic job test");
+	DEFINE_TEST_CASE(i2c_polled_test, NULL, run_i2c_polled_test, NULL, "I2C polled transfer test");
+	DEFINE_TEST_CASE(i2c_table_test, NULL, run_i2c_table_test, NULL, "I2C register table test");
+	DEFINE_TEST_CASE(i2c_flash_test, NULL, run_i2c_flash_test, NULL, "I2C flash payload test");
+	DEFINE_TEST_CASE(i2c_stream_test, NULL, run_i2c_stream_test, NULL, "I2C stream test");
+	DEFINE_TEST_CASE(i2c_watermark_test, NULL, run_i2c_watermark_test, NULL, "I2C RX watermark test");
+	DEFINE_TEST_CASE(i2c_completion_test, NULL, run_i2c_completion_test, NULL, "I2C deferred completion test");
+	DEFINE_TEST_CASE(i2c_slave_test, NULL, run_i2c_slave_test, NULL, "I2C slave register map test");
+	DEFINE_TEST_CASE(i2c_stats_test, NULL, run_i2c_stats_test, NULL, "I2C statistics test");
+	DEFINE_TEST_CASE(i2c_arbitration_test, NULL, run_i2c_arbitration_test, NULL, "I2C arbitration loss test");
+	DEFINE_TEST_CASE(i2c_arbitration_wait_test, NULL, run_i2c_arbitration_wait_test, NULL, "I2C arbitration wait test");
+	DEFINE_TEST_CASE(i2c_device_speed_test, NULL, run_i2c_device_speed_test, NULL, "I2C device speed test");
+	DEFINE_TEST_CASE(i2c_frequency_test, NULL, run_i2c_frequency_test, NULL, "I2C SCL frequency test");
+#if I2C_BUSES > 1
+	DEFINE_TEST_CASE(i2c_dual_bus_test, NULL, run_i2c_dual_bus_test, NULL, "I2C dual bus test");
+#endif
+
+	/* Put test case addresses in an array */
+	DEFINE_TEST_ARRAY(i2c_tests) = {
+		&i2c_write_test,
+		&i2c_write_read_test,
+		&i2c_segment_test,
+		&i2c_chain_test,
+		&i2c_ring_test,
+		&i2c_scheduler_test,
+		&i2c_nack_test,
+		&i2c_retry_test,
+		&i2c_watchdog_test,
+		&i2c_stats_test,
+		&i2c_periodic_test,
+		&i2c_polled_test,
+		&i2c_table_test,
+		&i2c_flash_test,
+		&i2c_stream_test,
+		&i2c_watermark_test,
+		&i2c_completion_test,
+		&i2c_slave_test,
+		&i2c_arbitration_test,
+		&i2c_arbitration_wait_test,
+		&i2c_device_speed_test,
+		&i2c_frequency_test,
+#if I2C_BUSES > 1
+		&i2c_dual_bus_test, // Last, leaves bus 1 enabled
+#endif
+	};
+
+	/* Define the test suite */
+	DEFINE_TEST_SUITE(i2c_suite, i2c_tests, "I2C host test suite");
+
+	/* Run all tests in the test suite */
+	int failures = test_i2c_suite_run(&i2c_suite);
+
+	i2c_free_device(i2c_device);
+	i2c_free_device(missing_device);
+
+	return failures != 0;
+}
@@ -84,6 +84,56 @@ static int run_i2c_payload_test(const struct test_case* test){
     return TEST_PASS;
 }
 
+static int run_i2c_payload_pool_test(const struct test_case* test) {
+
+	payload_t* payloads[I2C_PAYLOAD_POOL_SIZE];
+	uint8_t acquired = 0;
+	
+	/* Drain the pool, a previous transfer may still hold an entry */
+	while (acquired < I2C_PAYLOAD_POOL_SIZE) {
+		payloads[acquired] = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+		
+		if (payloads[acquired] == NULL) {
+			break;
+		}
+		
+		acquired++;
+	}
+	
+	int result = (acquired == 0 || i2c_payload_high_water_mark() != I2C_PAYLOAD_POOL_SIZE) ? TEST_FAIL : TEST_PASS;
+	
+	for (uint8_t i = 0; i < acquired; i++) {
+		if (i2c_payload_free(payloads[i]) != I2C_NO_ERROR) {
+			result = TEST_FAIL;
+		}
+	}
+	
+	return result;
+}
+
+static int run_i2c_wait_test(const struct test_case* test) {
+	
+	payload_t* payload = i2c_payload_create(PRIORITY_NORMAL, i2c_device, dummy_payload, ARRAY_LEN(dummy_payload), NULL);
+	
+	if (payload == NULL) {
+		return TEST_FAIL;
+	}
+	
+	i2c_handle_t handle = i2c_track(payload);
+	
+	if (handle == NULL || i2c_poll(handle) != I2C_ERROR_BUSY) {
+		return TEST_FAIL;
+	}
+	
+	i2c_write(payload);
+	
+	if (i2c_wait(handle) != I2C_NO_ERROR) {
+		return TEST_FAIL;
+	}
+	
+	return TEST_PASS;
+}
+
 void test_i2c(void) {
     
 	cli();		
@@ -99,10 +149,14 @@ void test_i2c(void) {
 	sei();	
   	
 	DEFINE_TEST_CASE(i2c_payload_test, NULL, run_i2c_payload_test, NULL, "I2C payload test");
+	DEFINE_TEST_CASE(i2c_payload_pool_test, NULL, run_i2c_payload_pool_test, NULL, "I2C payload pool test");
+	DEFINE_TEST_CASE(i2c_wait_test, NULL, run_i2c_wait_test, NULL, "I2C wait test");
 
 	/* Put test case addresses in an array */
 	DEFINE_TEST_ARRAY(i2c_tests) = {
 		&i2c_payload_test,
+		&i2c_payload_pool_test,
+		&i2c_wait_test,
 	};
 	
 	/* Define the test suite */